@@ -0,0 +1,116 @@
+#ifndef AUXILIARY_FIELD_HPP
+#define AUXILIARY_FIELD_HPP
+
+#include "types.hpp"
+#include "philox.hpp"
+
+#include <vector>
+#include <cstdint>
+
+// Ising Hubbard-Stratonovich field sigma(t, x) = +-1, one bit per spin.
+// Every slice starts on a 64 bit word boundary; a set bit means sigma=+1.
+//
+// The kernels multiply a matrix by the diagonal matrix whose x-th entry is
+// up if sigma(t, x)=+1 and dn otherwise, expanding the bits on the fly:
+// the inner loops are branch free and vectorize, and no diagonal vector
+// is ever built.
+class AuxiliaryField {
+	private:
+		int N_;
+		int V_;
+		int words_; // per slice
+		std::vector<uint64_t> bits_;
+
+		const uint64_t *slice (int t) const { return bits_.data() + size_t(t)*words_; }
+
+	public:
+		AuxiliaryField () : N_(0), V_(0), words_(0) {}
+
+		void resize (int N, int V) {
+			N_ = N;
+			V_ = V;
+			words_ = (V+63)/64;
+			bits_.assign(size_t(N)*words_, 0);
+		}
+
+		int slices () const { return N_; }
+		int volume () const { return V_; }
+
+		bool up (int t, int x) const { return (slice(t)[x/64] >> (x%64)) & 1; }
+		int operator() (int t, int x) const { return up(t, x)?+1:-1; }
+
+		void set (int t, int x, bool up) {
+			uint64_t &w = bits_[size_t(t)*words_+x/64];
+			const uint64_t m = uint64_t(1) << (x%64);
+			w = up?(w|m):(w&~m);
+		}
+
+		// every spin from one random bit
+		void randomize (Philox &g) { g.generate(bits_.data(), bits_.size()); }
+
+		void flip (int t, int x) { bits_[size_t(t)*words_+x/64] ^= uint64_t(1) << (x%64); }
+
+		void set_slice (int t, bool up) {
+			for (int w=0;w<words_;w++) bits_[size_t(t)*words_+w] = up?~uint64_t(0):0;
+		}
+
+		// number of +1 spins in slice t, or in the whole field
+		int count_up (int t) const {
+			int ret = 0;
+			const uint64_t *b = slice(t);
+			for (int w=0;w<words_;w++) {
+				uint64_t m = b[w];
+				if (w==words_-1 && V_%64!=0) m &= (uint64_t(1) << (V_%64)) - 1;
+				ret += __builtin_popcountll(m);
+			}
+			return ret;
+		}
+
+		int count_up () const {
+			int ret = 0;
+			for (int t=0;t<N_;t++) ret += count_up(t);
+			return ret;
+		}
+
+		// out(x) = up or dn according to sigma(t, x)
+		void expand (int t, double up, double dn, double *out) const {
+			const uint64_t *b = slice(t);
+			const double d = up-dn;
+			for (int w=0;w<words_;w++) {
+				const uint64_t bits = b[w];
+				const int n = w==words_-1?V_-64*w:64;
+				double *o = out + 64*w;
+				for (int i=0;i<n;i++) o[i] = dn + d*double((bits >> i) & 1);
+			}
+		}
+
+		void expand (int t, double up, double dn, Vector_d &out) const {
+			out.resize(V_);
+			expand(t, up, dn, out.data());
+		}
+
+		// M <- diag(up/dn) M
+		template <typename Derived>
+		void scale_rows (int t, Eigen::MatrixBase<Derived> &M, double up, double dn) const {
+			const uint64_t *b = slice(t);
+			const double d = up-dn;
+			for (int j=0;j<M.cols();j++) {
+				double *c = &M.derived().coeffRef(0, j);
+				for (int w=0;w<words_;w++) {
+					const uint64_t bits = b[w];
+					const int n = w==words_-1?V_-64*w:64;
+					double *o = c + 64*w;
+					for (int i=0;i<n;i++) o[i] *= dn + d*double((bits >> i) & 1);
+				}
+			}
+		}
+
+		// M <- M diag(up/dn)
+		template <typename Derived>
+		void scale_cols (int t, Eigen::MatrixBase<Derived> &M, double up, double dn) const {
+			for (int j=0;j<M.cols();j++) M.col(j) *= this->up(t, j)?up:dn;
+		}
+};
+
+#endif // AUXILIARY_FIELD_HPP
+
@@ -0,0 +1,194 @@
+#ifndef BINARY_IO_HPP
+#define BINARY_IO_HPP
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+
+extern "C" {
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+}
+
+// FNV-1a hash, used to detect truncated or corrupted files
+inline uint64_t binary_checksum (const char *data, size_t n) {
+	uint64_t h = 14695981039346656037ull;
+	for (size_t i=0;i<n;i++) {
+		h ^= (unsigned char)data[i];
+		h *= 1099511628211ull;
+	}
+	return h;
+}
+
+// Accumulates a binary record in memory and commits it atomically:
+// the data goes to a temporary file which is synced and then renamed
+// over the destination, so a crash never leaves a half-written file.
+class BinaryOutput {
+	private:
+		std::vector<char> buffer_;
+	public:
+		void clear () { buffer_.clear(); }
+		void reserve (size_t n) { buffer_.reserve(n); }
+		size_t size () const { return buffer_.size(); }
+		const char *data () const { return buffer_.data(); }
+
+		template <typename T>
+		void write (const T *x, size_t n) {
+			const char *p = reinterpret_cast<const char *>(x);
+			buffer_.insert(buffer_.end(), p, p+n*sizeof(T));
+		}
+
+		template <typename T>
+		void write (const T &x) { write(&x, 1); }
+
+		void write_string (const std::string &s) {
+			uint32_t n = s.size();
+			write(n);
+			write(s.data(), n);
+		}
+
+		// appends the checksum of everything written so far
+		void write_checksum () {
+			uint64_t h = binary_checksum(data(), size());
+			write(h);
+		}
+
+		bool commit (const std::string &fn) const {
+			std::string tmp = fn + ".tmp";
+			int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+			if (fd<0) return false;
+			size_t done = 0;
+			while (done<buffer_.size()) {
+				ssize_t w = ::write(fd, buffer_.data()+done, buffer_.size()-done);
+				if (w<0) {
+					::close(fd);
+					::unlink(tmp.c_str());
+					return false;
+				}
+				done += w;
+			}
+			if (::fsync(fd)!=0 || ::close(fd)!=0) {
+				::unlink(tmp.c_str());
+				return false;
+			}
+			return ::rename(tmp.c_str(), fn.c_str())==0;
+		}
+};
+
+// Reads a binary record either through a read-only memory map or from a
+// copy in memory. Reads past the end put the stream in a failed state.
+class BinaryInput {
+	private:
+		const char *data_;
+		size_t size_;
+		size_t pos_;
+		void *map_;
+		std::vector<char> buffer_;
+		bool good_;
+	public:
+		BinaryInput () : data_(nullptr), size_(0), pos_(0), map_(nullptr), good_(false) {}
+		BinaryInput (const BinaryInput&) = delete;
+		BinaryInput& operator= (const BinaryInput&) = delete;
+		~BinaryInput () { close(); }
+
+		bool open (const std::string &fn, bool use_mmap = true) {
+			close();
+			int fd = ::open(fn.c_str(), O_RDONLY);
+			if (fd<0) return false;
+			struct stat st;
+			if (::fstat(fd, &st)!=0) {
+				::close(fd);
+				return false;
+			}
+			size_ = st.st_size;
+			if (use_mmap && size_>0) {
+				map_ = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+				if (map_==MAP_FAILED) {
+					map_ = nullptr;
+				} else {
+					data_ = static_cast<const char *>(map_);
+				}
+			}
+			if (map_==nullptr) {
+				buffer_.resize(size_);
+				size_t done = 0;
+				while (done<size_) {
+					ssize_t r = ::read(fd, buffer_.data()+done, size_-done);
+					if (r<=0) break;
+					done += r;
+				}
+				size_ = done;
+				data_ = buffer_.data();
+			}
+			::close(fd);
+			pos_ = 0;
+			good_ = true;
+			return true;
+		}
+
+		void close () {
+			if (map_!=nullptr) ::munmap(map_, size_);
+			map_ = nullptr;
+			buffer_.clear();
+			data_ = nullptr;
+			size_ = 0;
+			pos_ = 0;
+			good_ = false;
+		}
+
+		bool good () const { return good_; }
+		bool mapped () const { return map_!=nullptr; }
+		const char *data () const { return data_; }
+		size_t size () const { return size_; }
+		size_t position () const { return pos_; }
+
+		template <typename T>
+		bool read (T *x, size_t n) {
+			if (!good_ || n*sizeof(T)>size_-pos_) {
+				good_ = false;
+				return false;
+			}
+			std::memcpy(x, data_+pos_, n*sizeof(T));
+			pos_ += n*sizeof(T);
+			return true;
+		}
+
+		template <typename T>
+		bool read (T &x) { return read(&x, 1); }
+
+		bool read_string (std::string &s) {
+			uint32_t n = 0;
+			if (!read(n) || n>size_-pos_) {
+				good_ = false;
+				return false;
+			}
+			s.assign(data_+pos_, n);
+			pos_ += n;
+			return true;
+		}
+
+		// checks the trailing checksum against the rest of the file
+		bool verify_checksum () const {
+			uint64_t h;
+			if (size_<sizeof(h)) return false;
+			std::memcpy(&h, data_+size_-sizeof(h), sizeof(h));
+			return h==binary_checksum(data_, size_-sizeof(h));
+		}
+};
+
+// true if the file starts with the given magic bytes
+inline bool binary_has_magic (const std::string &fn, const char *magic, size_t n) {
+	std::vector<char> buf(n);
+	FILE *f = std::fopen(fn.c_str(), "rb");
+	if (f==nullptr) return false;
+	size_t r = std::fread(buf.data(), 1, n, f);
+	std::fclose(f);
+	return r==n && std::memcmp(buf.data(), magic, n)==0;
+}
+
+#endif // BINARY_IO_HPP
+
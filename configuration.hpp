@@ -50,8 +50,9 @@ class Configuration {
 		//Eigen::FullPivLU<Eigen::MatrixXd> lu;
 		Eigen::PartialPivLU<Eigen::MatrixXd> lu;
 	public:
-		//Configuration (const Model &m) : model(m), index(0) {}
 		explicit Configuration (const Parameters &p) : model(p), index(0) {}
+		// copies a model that was already set up (its lattice data is shared)
+		Configuration (const Parameters &p, const Model &m) : model(m), index(0) {}
 		Configuration () = delete;
 
 		void setup (const Parameters &p) {
@@ -104,6 +105,7 @@ class Configuration {
 		}
 
 		void compute_all_propagators (const SVDHelper &left, const SVDHelper &right, Eigen::MatrixXd &ret, double zl = 1.0, double zr = 1.0) {
+			PHASE_TIMER(propagators);
 			size_t N = left.S.size();
 			size_t M = (right.S.array().abs()*zr>1.0).count() + (left.S.array().abs()*zl>1.0).count();
 			//Eigen::MatrixXd big_matrix = Eigen::MatrixXd::Zero(2*N, 2*N);
@@ -203,11 +205,50 @@ class Configuration {
 			slices[index].insert(v);
 		}
 
+		// changes the interaction strength keeping the vertex configuration:
+		// all decompositions must be recomputed afterwards
+		void set_interaction_strength (double U) {
+			Interaction &I = model.interaction();
+			I.set_interaction_strength(U);
+			for (size_t i=0;i<M;i++) {
+				slices[i].transform_vertices([&I] (Vertex &v) { I.remap(v); });
+			}
+		}
+
+		double interaction_strength () const { return model.interaction().interaction_strength(); }
+
+		// all vertices, with times measured from 0 instead of the slice start
+		std::vector<Vertex> vertex_list () const {
+			std::vector<Vertex> ret;
+			for (size_t i=0;i<M;i++) {
+				slices[i].for_each_vertex([&] (Vertex v) { v.tau += dtau*i; ret.push_back(v); });
+			}
+			return ret;
+		}
+
+		// replaces the configuration with vs, taken at inverse temperature b:
+		// the times are stretched to [0, beta) and the vertices rebuilt for the
+		// current interaction. Vertices on sites beyond the current lattice
+		// (when the volume shrinks) are dropped. All decompositions must be
+		// recomputed afterwards
+		void set_vertices (const std::vector<Vertex> &vs, double b) {
+			for (size_t i=0;i<M;i++) slices[i].clear();
+			for (Vertex v : vs) {
+				if (size_t(v.x)>=model.interaction().interacting_sites()) continue;
+				double t = v.tau*beta/b;
+				size_t i = std::min(size_t(t/dtau), M-1);
+				v.tau = t - dtau*i;
+				model.interaction().remap(v);
+				slices[i].insert(v);
+			}
+		}
+
 		size_t remove (const Vertex &v) {
 			return slices[index].remove(v);
 		}
 
 		void insert_and_update (const Vertex &v, const MatrixType& matrixU, const MatrixType& matrixVt, const Eigen::Matrix2d &mat) {
+			PHASE_TIMER(accepted_update);
 			G_matrix -= (G_matrix * matrixU) * mat.inverse() * (matrixVt.transpose() * G_matrix);
 			G_matrix += matrixU * (matrixVt.transpose() * G_matrix);
 			B.U += matrixU * (matrixVt.transpose() * B.U);
@@ -223,6 +264,7 @@ class Configuration {
 		}
 
 		size_t remove_and_update (const Vertex &v, const MatrixType& inverseU, const MatrixType& inverseVt, const Eigen::Matrix2d &mat) {
+			PHASE_TIMER(accepted_update);
 			G_matrix -= (G_matrix * inverseU) * mat.inverse() * (inverseVt.transpose() * G_matrix);
 			G_matrix += inverseU * (inverseVt.transpose() * G_matrix);
 			B.U += inverseU * (inverseVt.transpose() * B.U);
@@ -238,6 +280,7 @@ class Configuration {
 		}
 
 		void insert_and_update_right (const Vertex &v, const MatrixType& matrixU, const MatrixType& matrixVt, const Eigen::Matrix2d &mat) {
+			PHASE_TIMER(accepted_update);
 			G_matrix -= (G_matrix * matrixU) * mat.inverse() * (matrixVt.transpose() * G_matrix);
 			G_matrix += (G_matrix * matrixU) * matrixVt.transpose();
 			B.U += matrixU * (matrixVt.transpose() * B.U);
@@ -253,6 +296,7 @@ class Configuration {
 		}
 
 		size_t remove_and_update_right (const Vertex &v, const MatrixType& inverseU, const MatrixType& inverseVt, const Eigen::Matrix2d &mat) {
+			PHASE_TIMER(accepted_update);
 			G_matrix -= (G_matrix * inverseU) * mat.inverse() * (inverseVt.transpose() * G_matrix);
 			G_matrix += (G_matrix * inverseU) * inverseVt.transpose();
 			B.U += inverseU * (inverseVt.transpose() * B.U);
@@ -422,7 +466,8 @@ class Configuration {
 		size_t current_slice () const { return index; }
 
 		Vertex get_vertex (size_t i) const { return slices[index].get_vertex(i); }
-		Vertex generate_vertex (std::mt19937_64 &generator) { return model.interaction().generate(0.0, slice_end()-slice_start(), generator); }
+		template <typename G>
+		Vertex generate_vertex (G &generator) { return model.interaction().generate(0.0, slice_end()-slice_start(), generator); }
 
 		double insert_factor () { return +log(beta/slice_number()) -log(slice_size()+1) +model.interaction().combinatorial_factor(); }
 		double remove_factor () { return -log(beta/slice_number()) +log(slice_size()+0) -model.interaction().combinatorial_factor(); }
@@ -435,6 +480,7 @@ class Configuration {
 		const Slice<Interaction> & slice (size_t i) const { return slices[i]; }
 
 		size_t volume () const { return model.interaction().volume(); }
+		const Interaction &interaction () const { return model.interaction(); }
 		double inverse_temperature () const { return beta; }
 
 		// observables
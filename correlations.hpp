@@ -0,0 +1,156 @@
+#ifndef CORRELATIONS_HPP
+#define CORRELATIONS_HPP
+
+#include "types.hpp"
+
+#include <vector>
+
+extern "C" {
+#include <fftw3.h>
+}
+
+// Equal-time correlation functions on a periodic Lx x Ly x Lz lattice.
+// Sites are indexed as x*Ly*Lz + y*Lz + z, as everywhere in Simulation.
+// Lattice shifts use precomputed neighbor tables and coordinates instead of
+// integer division; translation-invariant correlations are evaluated as
+// convolutions with one batched FFT each way.
+class LatticeCorrelations {
+	public:
+		enum direction { plus_x = 0, minus_x, plus_y, minus_y, plus_z, minus_z };
+
+	private:
+		int Lx, Ly, Lz;
+		int V;
+		std::vector<int> cx_, cy_, cz_;
+		std::vector<int> neighbors_;
+		fftw_complex *in_;
+		fftw_complex *out_;
+		fftw_plan forward_;
+		fftw_plan backward_;
+		Matrix_d tmp_;
+		Matrix_d exchange_;
+		std::vector<double> spin_;
+		std::vector<double> density_;
+		std::vector<double> structure_;
+
+	public:
+		LatticeCorrelations () : Lx(0), Ly(0), Lz(0), V(0), in_(nullptr), out_(nullptr), forward_(nullptr), backward_(nullptr) {}
+		LatticeCorrelations (const LatticeCorrelations&) = delete;
+		LatticeCorrelations& operator= (const LatticeCorrelations&) = delete;
+
+		// creates and destroys the FFTW plans: the caller must hold the planner lock
+		void setup (int lx, int ly, int lz) {
+			destroy();
+			Lx = lx;
+			Ly = ly;
+			Lz = lz;
+			V = Lx*Ly*Lz;
+			cx_.resize(V);
+			cy_.resize(V);
+			cz_.resize(V);
+			neighbors_.resize(6*V);
+			for (int i=0;i<V;i++) {
+				cx_[i] = i/(Ly*Lz);
+				cy_[i] = (i/Lz)%Ly;
+				cz_[i] = i%Lz;
+			}
+			for (int i=0;i<V;i++) {
+				int x = cx_[i], y = cy_[i], z = cz_[i];
+				neighbors_[6*i+plus_x] = site((x+1)%Lx, y, z);
+				neighbors_[6*i+minus_x] = site((x+Lx-1)%Lx, y, z);
+				neighbors_[6*i+plus_y] = site(x, (y+1)%Ly, z);
+				neighbors_[6*i+minus_y] = site(x, (y+Ly-1)%Ly, z);
+				neighbors_[6*i+plus_z] = site(x, y, (z+1)%Lz);
+				neighbors_[6*i+minus_z] = site(x, y, (z+Lz-1)%Lz);
+			}
+			const int size[] = { Lx, Ly, Lz, };
+			in_ = fftw_alloc_complex(3*V);
+			out_ = fftw_alloc_complex(3*V);
+			forward_ = fftw_plan_many_dft(3, size, 3, in_, NULL, 1, V, out_, NULL, 1, V, FFTW_FORWARD, FFTW_ESTIMATE);
+			backward_ = fftw_plan_many_dft(3, size, 2, out_, NULL, 1, V, in_, NULL, 1, V, FFTW_BACKWARD, FFTW_ESTIMATE);
+			spin_.resize(V);
+			density_.resize(V);
+			structure_.resize(V);
+		}
+
+		void destroy () {
+			if (forward_) fftw_destroy_plan(forward_);
+			if (backward_) fftw_destroy_plan(backward_);
+			if (in_) fftw_free(in_);
+			if (out_) fftw_free(out_);
+			forward_ = backward_ = nullptr;
+			in_ = out_ = nullptr;
+		}
+
+		int site (int x, int y, int z) const { return x*Ly*Lz + y*Lz + z; }
+		int neighbor (int i, direction d) const { return neighbors_[6*i+d]; }
+
+		// index of the displacement from site i to site j
+		int difference (int i, int j) const {
+			int x = cx_[j]-cx_[i], y = cy_[j]-cy_[i], z = cz_[j]-cz_[i];
+			if (x<0) x += Lx;
+			if (y<0) y += Ly;
+			if (z<0) z += Lz;
+			return site(x, y, z);
+		}
+
+		// sum_{x,y} up(x, y) (D dn D^T)(x, y) / V^2 where D is the d-wave form factor
+		// (+1 on x bonds, -1 on y bonds): 8 V^2 lookups instead of 16 shifts per pair
+		double pair_correlation (const Matrix_d &up, const Matrix_d &dn) {
+			tmp_.resize(V, V);
+			for (int y=0;y<V;y++) {
+				for (int x=0;x<V;x++) {
+					tmp_(x, y) = dn(neighbor(x, plus_x), y) + dn(neighbor(x, minus_x), y)
+						- dn(neighbor(x, plus_y), y) - dn(neighbor(x, minus_y), y);
+				}
+			}
+			double ret = 0.0;
+			for (int y=0;y<V;y++) {
+				ret += up.col(y).dot(tmp_.col(neighbor(y, plus_x)) + tmp_.col(neighbor(y, minus_x))
+						- tmp_.col(neighbor(y, plus_y)) - tmp_.col(neighbor(y, minus_y)));
+			}
+			return ret / V / V;
+		}
+
+		// computes, from the equal-time density matrices,
+		//   C(r) = sum_x m(x) m(x+r) - X(r)      (m = n_up - n_dn)
+		//   D(r) = sum_x n(x) n(x+r) - X(r)      (n = n_up + n_dn)
+		//   S(q) = sum_r exp(-iqr) C(r)
+		// where X(r) = sum_x up(x,x+r)up(x+r,x) + dn(x,x+r)dn(x+r,x) is the exchange term
+		void compute (const Matrix_d &up, const Matrix_d &dn) {
+			exchange_ = up.array() * up.transpose().array() + dn.array() * dn.transpose().array();
+			for (int i=0;i<3*V;i++) in_[i][0] = in_[i][1] = 0.0;
+			for (int x=0;x<V;x++) {
+				in_[x][0] = up(x, x) - dn(x, x);
+				in_[V+x][0] = up(x, x) + dn(x, x);
+			}
+			for (int y=0;y<V;y++) {
+				for (int x=0;x<V;x++) {
+					in_[2*V+difference(x, y)][0] += exchange_(x, y);
+				}
+			}
+			fftw_execute(forward_);
+			for (int q=0;q<V;q++) {
+				double m2 = out_[q][0]*out_[q][0] + out_[q][1]*out_[q][1];
+				double n2 = out_[V+q][0]*out_[V+q][0] + out_[V+q][1]*out_[V+q][1];
+				double e = out_[2*V+q][0];
+				structure_[q] = m2 - e;
+				out_[q][0] = (m2 - e)/V;
+				out_[q][1] = 0.0;
+				out_[V+q][0] = (n2 - e)/V;
+				out_[V+q][1] = 0.0;
+			}
+			fftw_execute(backward_);
+			for (int r=0;r<V;r++) {
+				spin_[r] = in_[r][0];
+				density_[r] = in_[V+r][0];
+			}
+		}
+
+		const std::vector<double> &spin_correlation () const { return spin_; }
+		const std::vector<double> &density_correlation () const { return density_; }
+		const std::vector<double> &structure_factor () const { return structure_; }
+};
+
+#endif // CORRELATIONS_HPP
+
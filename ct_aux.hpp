@@ -1,6 +1,8 @@
 #ifndef CT_AUX_HPP
 #define CT_AUX_HPP
 
+#include "philox.hpp"
+
 #include <Eigen/Dense>
 #include <Eigen/QR>
 
@@ -34,7 +36,7 @@ class ctaux_sim : public alps::mcbase_ng {
 	std::map<double, Eigen::VectorXd> diagonals;
 
 	//std::default_random_engine generator;
-	std::mt19937_64 generator;
+	Philox generator;
 	std::bernoulli_distribution distribution;
 	std::uniform_real_distribution<double> randomDouble;
 	std::uniform_real_distribution<double> randomTime;
@@ -6,6 +6,7 @@
 #include "svd.hpp"
 #include "types.hpp"
 #include "measurements.hpp"
+#include "philox.hpp"
 
 #include <fstream>
 #include <random>
@@ -136,7 +137,7 @@ class CTSimulation {
 
 
 	// Monte Carlo scheme settings
-	std::mt19937_64 generator;
+	Philox generator;
 	bool reset;
 	std::string outfn;
 	std::string gf_name;
@@ -6,6 +6,8 @@
 #include <chrono>
 #include <functional>
 
+#include "philox.hpp"
+
 #include <alps/alea.h>
 #include <alps/alea/mcanalyze.hpp>
 
@@ -21,7 +23,7 @@ class Configuration {
 
 	std::map<double, double> diagonals;
 
-	std::default_random_engine generator;
+	Philox generator;
 	std::bernoulli_distribution distribution;
 	std::uniform_real_distribution<double> randomDouble;
 	std::uniform_real_distribution<double> randomTime;
@@ -0,0 +1,147 @@
+#ifndef DOUBLEDOUBLE_HPP
+#define DOUBLEDOUBLE_HPP
+
+#include <cmath>
+#include <limits>
+#include <iostream>
+
+#include <Eigen/Core>
+
+// Double-double scalar: the unevaluated sum hi+lo of two doubles with
+// |lo| <= ulp(hi)/2, giving about 106 bits of mantissa with the exponent
+// range of a double. All operations are branch free sequences of double
+// operations (Dekker/Knuth error-free transformations, with fma for the
+// products), so matrices of dd_real live in plain contiguous storage and
+// work with Eigen's dense decompositions.
+//
+// Requires strict IEEE double arithmetic: do not build with -ffast-math.
+struct dd_real {
+	double hi, lo;
+
+	dd_real () : hi(0.0), lo(0.0) {}
+	dd_real (double x) : hi(x), lo(0.0) {}
+	dd_real (int x) : hi(x), lo(0.0) {}
+	dd_real (double h, double l) : hi(h), lo(l) {}
+
+	explicit operator double () const { return hi+lo; }
+
+	static dd_real two_sum (double a, double b) {
+		double s = a+b;
+		double v = s-a;
+		return dd_real(s, (a-(s-v))+(b-v));
+	}
+
+	static dd_real quick_two_sum (double a, double b) {
+		double s = a+b;
+		return dd_real(s, b-(s-a));
+	}
+
+	static dd_real two_prod (double a, double b) {
+		double p = a*b;
+		return dd_real(p, std::fma(a, b, -p));
+	}
+
+	dd_real operator- () const { return dd_real(-hi, -lo); }
+
+	dd_real &operator+= (const dd_real &b) {
+		dd_real s = two_sum(hi, b.hi);
+		dd_real t = two_sum(lo, b.lo);
+		s.lo += t.hi;
+		s = quick_two_sum(s.hi, s.lo);
+		s.lo += t.lo;
+		return *this = quick_two_sum(s.hi, s.lo);
+	}
+
+	dd_real &operator-= (const dd_real &b) { return *this += -b; }
+
+	dd_real &operator*= (const dd_real &b) {
+		dd_real p = two_prod(hi, b.hi);
+		p.lo += hi*b.lo + lo*b.hi;
+		return *this = quick_two_sum(p.hi, p.lo);
+	}
+
+	dd_real &operator*= (double b) {
+		dd_real p = two_prod(hi, b);
+		p.lo += lo*b;
+		return *this = quick_two_sum(p.hi, p.lo);
+	}
+
+	// long division: two correction steps
+	dd_real &operator/= (const dd_real &b) {
+		double q1 = hi/b.hi;
+		dd_real r = *this;
+		r -= dd_real(b)*=q1;
+		double q2 = r.hi/b.hi;
+		r -= dd_real(b)*=q2;
+		double q3 = r.hi/b.hi;
+		dd_real q = quick_two_sum(q1, q2);
+		return *this = q += q3;
+	}
+};
+
+inline dd_real operator+ (dd_real a, const dd_real &b) { return a += b; }
+inline dd_real operator- (dd_real a, const dd_real &b) { return a -= b; }
+inline dd_real operator* (dd_real a, const dd_real &b) { return a *= b; }
+inline dd_real operator/ (dd_real a, const dd_real &b) { return a /= b; }
+
+inline bool operator== (const dd_real &a, const dd_real &b) { return a.hi==b.hi && a.lo==b.lo; }
+inline bool operator!= (const dd_real &a, const dd_real &b) { return !(a==b); }
+inline bool operator< (const dd_real &a, const dd_real &b) { return a.hi<b.hi || (a.hi==b.hi && a.lo<b.lo); }
+inline bool operator> (const dd_real &a, const dd_real &b) { return b<a; }
+inline bool operator<= (const dd_real &a, const dd_real &b) { return !(b<a); }
+inline bool operator>= (const dd_real &a, const dd_real &b) { return !(a<b); }
+
+inline dd_real abs (const dd_real &a) { return a.hi<0.0?-a:a; }
+inline dd_real fabs (const dd_real &a) { return abs(a); }
+inline dd_real abs2 (const dd_real &a) { return a*a; }
+inline dd_real conj (const dd_real &a) { return a; }
+inline dd_real real (const dd_real &a) { return a; }
+inline dd_real imag (const dd_real &) { return dd_real(0.0); }
+inline bool isfinite (const dd_real &a) { return std::isfinite(a.hi); }
+inline bool isnan (const dd_real &a) { return std::isnan(a.hi); }
+inline bool isinf (const dd_real &a) { return std::isinf(a.hi); }
+
+// one Newton step on the double square root
+inline dd_real sqrt (const dd_real &a) {
+	if (a.hi<=0.0) return dd_real(std::sqrt(a.hi));
+	double x = std::sqrt(a.hi);
+	dd_real r = a - dd_real::two_prod(x, x);
+	return dd_real::quick_two_sum(x, r.hi*0.5/x);
+}
+
+// log|a| to double accuracy, which is all the determinant checks need
+inline double log_abs (const dd_real &a) {
+	return std::log(std::fabs(a.hi)) + a.lo/a.hi;
+}
+
+inline double log_abs (double a) { return std::log(std::fabs(a)); }
+
+inline std::ostream &operator<< (std::ostream &out, const dd_real &a) {
+	return out << a.hi << (a.lo<0.0?"":"+") << a.lo;
+}
+
+namespace Eigen {
+template<> struct NumTraits<dd_real> : GenericNumTraits<dd_real> {
+	typedef dd_real Real;
+	typedef dd_real NonInteger;
+	typedef dd_real Nested;
+	typedef double Literal;
+	enum {
+		IsComplex = 0,
+		IsInteger = 0,
+		IsSigned = 1,
+		RequireInitialization = 1,
+		ReadCost = 2,
+		AddCost = 20,
+		MulCost = 10,
+	};
+	static inline Real epsilon () { return dd_real(4.93038065763132e-32); } // 2^-104
+	static inline Real dummy_precision () { return dd_real(1.0e-28); }
+	static inline Real highest () { return dd_real(std::numeric_limits<double>::max()); }
+	static inline Real lowest () { return dd_real(-std::numeric_limits<double>::max()); }
+	static inline int digits10 () { return 31; }
+};
+}
+
+#endif // DOUBLEDOUBLE_HPP
+
@@ -0,0 +1,96 @@
+#ifndef EQUILIBRATION_HPP
+#define EQUILIBRATION_HPP
+
+#include "measurements.hpp"
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <limits>
+#include <algorithm>
+#include <cmath>
+
+// Online detection of the end of thermalization. Every observable is
+// recorded once per sweep; after n sweeps the first half is treated as
+// burn-in and the means of the third and fourth quarters are compared.
+// Their errors come from the binning of measurement<double>: the largest
+// error among the levels with at least 8 bins, so that autocorrelations
+// are accounted for. The chain is considered stationary when no observable
+// has drifted by more than threshold standard deviations in any check since
+// sweep n0, and n >= 3/2 n0: a single pass is too easy to get by chance when
+// the drift is comparable to the noise. Checks start at min_sweeps and are
+// spaced by 16 sweeps or 1/32 of the sweeps so far, whichever is larger,
+// which keeps their total cost linear in the length of the thermalization.
+class EquilibrationDetector {
+	private:
+		struct series {
+			std::string name;
+			std::vector<double> values;
+		};
+		std::vector<series> series_;
+		size_t min_sweeps_;
+		double threshold_;
+		size_t sweeps_;
+		size_t last_check_;
+		size_t first_pass_; // start of the current run of passed checks, 0 if none
+		bool equilibrated_;
+		std::string status_;
+
+		static void window (const std::vector<double> &v, size_t a, size_t b, double &mean, double &error) {
+			measurement<double> m;
+			for (size_t i=a;i<b;i++) m.add(v[i]);
+			mean = m.mean();
+			error = 0.0;
+			for (size_t i=0;i<m.bins();i++) {
+				if (m.samples(i)>=8) error = std::max(error, m.error(i));
+			}
+		}
+
+	public:
+		EquilibrationDetector (size_t min_sweeps = 64, double threshold = 2.0)
+			: min_sweeps_(std::max(min_sweeps, size_t(64))), threshold_(threshold), sweeps_(0), last_check_(0), first_pass_(0), equilibrated_(false) {}
+
+		int add_observable (const std::string &name) {
+			series_.push_back(series());
+			series_.back().name = name;
+			return series_.size()-1;
+		}
+
+		void add (int i, double x) { series_[i].values.push_back(x); }
+
+		// to be called once per sweep, after add() for every observable
+		bool check () {
+			sweeps_++;
+			if (equilibrated_ || sweeps_<min_sweeps_ || sweeps_%16!=0 || 32*(sweeps_-last_check_)<sweeps_) return equilibrated_;
+			last_check_ = sweeps_;
+			double worst = 0.0;
+			std::string name;
+			for (const series &s : series_) {
+				const size_t n = s.values.size();
+				double m3, e3, m4, e4;
+				window(s.values, n/2, 3*n/4, m3, e3);
+				window(s.values, 3*n/4, n, m4, e4);
+				double d = std::fabs(m4-m3);
+				double e = std::sqrt(e3*e3+e4*e4);
+				double z = d>0.0?(e>0.0?d/e:std::numeric_limits<double>::infinity()):0.0;
+				if (z>=worst) {
+					worst = z;
+					name = s.name;
+				}
+			}
+			if (worst>=threshold_) first_pass_ = 0;
+			else if (first_pass_==0) first_pass_ = sweeps_;
+			equilibrated_ = first_pass_>0 && 2*sweeps_>=3*first_pass_;
+			std::ostringstream out;
+			out << "largest drift " << worst << " sigma (" << name << ") after " << sweeps_ << " sweeps";
+			status_ = out.str();
+			return equilibrated_;
+		}
+
+		bool equilibrated () const { return equilibrated_; }
+		size_t sweeps () const { return sweeps_; }
+		const std::string &status () const { return status_; }
+};
+
+#endif // EQUILIBRATION_HPP
+
@@ -5,6 +5,8 @@
 #include <chrono>
 #include <functional>
 
+#include "philox.hpp"
+
 #include <alps/alea.h>
 #include <alps/alea/mcanalyze.hpp>
 
@@ -69,7 +71,7 @@ class Configuration {
 
 	std::vector<Eigen::VectorXd> diagonals;
 
-	std::default_random_engine generator;
+	Philox generator;
 	std::bernoulli_distribution distribution;
 	std::uniform_int_distribution<int> randomPosition;
 	std::uniform_int_distribution<int> randomTime;
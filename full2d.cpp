@@ -5,6 +5,8 @@
 #include <chrono>
 #include <functional>
 
+#include "philox.hpp"
+
 #include <alps/alea.h>
 #include <alps/alea/mcanalyze.hpp>
 
@@ -33,7 +35,7 @@ class Configuration {
 
 	std::vector<Eigen::VectorXd> diagonals;
 
-	std::default_random_engine generator;
+	Philox generator;
 	std::bernoulli_distribution distribution;
 	std::exponential_distribution<double> trialDistribution;
 
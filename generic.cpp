@@ -1,8 +1,14 @@
 #include "lctsimulation.hpp"
 #include "measurements.hpp"
+#include "matrix_measurement.hpp"
 #include "configuration.hpp"
 #include "slice.hpp"
 #include "hubbard.hpp"
+#include "threadpool.hpp"
+#include "equilibration.hpp"
+#include "pipeline.hpp"
+#include "local_observables.hpp"
+#include "timers.hpp"
 
 #include <random>
 #include <iostream>
@@ -10,6 +16,8 @@
 #include <Eigen/Dense>
 
 #include <algorithm>
+#include <array>
+#include <memory>
 
 using namespace std;
 using namespace Eigen;
@@ -19,35 +27,169 @@ double relative_error (double a, double b) {
 }
 
 
+// state of a chain needed by the observables. The energies are evaluated
+// with the model of sim, which must not change while a sample is pending.
+struct Sample {
+	const LCTSimulation *sim;
+	double sign;
+	size_t vertices;
+	size_t time_position;
+	size_t slices;
+	MatrixXd G;
+	MatrixXd G_tau;
+	void take (const LCTSimulation &s) {
+		PHASE_TIMER(snapshot);
+		sim = &s;
+		sign = s.sign();
+		vertices = s.vertices();
+		time_position = s.time_position();
+		slices = s.configuration().slice_number();
+		G = s.green_function();
+		s.response_function(G_tau);
+	}
+};
+
 class Measurements {
-	MatrixXd cache;
+	Sample sample;
+	LocalObservables<LCTSimulation::Interaction> local;
+	vector<pair<size_t, size_t>> bonds; // pairs of sites with non-zero hopping
+	int gf_levels;
+	int gf_error_level;
 	public:
 	measurement<double> Sign;
-	measurement<ArrayXXd> Dens;
+	matrix_measurement Dens;
 	measurement<double> Kin;
 	measurement<double> Int;
+	measurement<double> Docc;
+	measurement<double> SzSz;
 	measurement<double> Verts;
-	vector<measurement<ArrayXXd>> gf;
-	Measurements () : Sign("Sign"), Dens("Density"), Kin("Kinetic Energy"), Int("Interaction Energy"), Verts("Vertices") {}
-	void measure (const LCTSimulation &sim) {
+	measurement<double> Order; // sign*k at every step
+	vector<array<double, 4>> order_blocks; // steps, sign, sign*k and sign*k^2 per block of 1024 steps
+	// samples, sign, sign*n_I and sign*E_kin/V per block of 64 Green function
+	// samples, with n_I the density summed over the interacting sites; kept
+	// apart from order_blocks, which the chain fills while add() may run on
+	// a worker thread
+	vector<array<double, 4>> green_blocks;
+	double beta, shift, U; // of the last order measurement
+	size_t sites; // interacting sites, of the last order measurement
+	vector<matrix_measurement> gf;
+	Measurements (int levels = 16, int error_level = -1) : gf_levels(levels), gf_error_level(error_level),
+		Sign("Sign"), Dens("Density", levels, error_level), Kin("Kinetic Energy"), Int("Interaction Energy"),
+		Docc("Double Occupancy"), SzSz("Nearest Neighbour SzSz"), Verts("Vertices"),
+		Order("Expansion Order"), beta(1.0), shift(0.0), U(0.0), sites(0) {}
+	// O(1): to be called at every step, while measure() can be called less often
+	void measure_order (const LCTSimulation &sim) {
 		double sign = sim.sign();
+		double k = sim.order();
+		Order.add(sign*k);
+		if (order_blocks.empty() || order_blocks.back()[0]>=1024) order_blocks.push_back(array<double, 4>{ { 0.0, 0.0, 0.0, 0.0, } });
+		array<double, 4> &b = order_blocks.back();
+		b[0] += 1.0;
+		b[1] += sign;
+		b[2] += sign*k;
+		b[3] += sign*k*k;
+		beta = sim.inverse_temperature();
+		shift = sim.order_shift();
+		U = sim.interaction_strength();
+		sites = sim.interaction().interacting_sites();
+	}
+	void measure (const LCTSimulation &sim) {
+		sample.take(sim);
+		add(sample);
+	}
+	void add (const Sample &s) {
+		PHASE_TIMER(measurements);
+		const LCTSimulation &sim = *s.sim;
+		double sign = s.sign;
 		Sign.add(sign);
-		cache = sim.green_function();
-		Dens.add(sign*cache);
-		Kin.add(sign*sim.kinetic_energy(cache)/sim.volume());
-		Int.add(sign*sim.interaction_energy(cache)/sim.volume());
-		Verts.add(sim.vertices());
+		Dens.add(sign, s.G);
+		const double kin = sim.kinetic_energy(s.G)/sim.volume();
+		Kin.add(sign*kin);
+		// the local terms straight from the eigenbasis G, see LocalObservables
+		const size_t V = sim.volume();
+		const size_t I = sim.interaction().interacting_sites();
+		local.set(sim.interaction(), s.G);
+		double docc = 0.0, docc_I = 0.0, n_I = 0.0;
+		for (size_t x=0;x<V;x++) docc += local.double_occupancy(x);
+		for (size_t x=0;x<I && x<V;x++) docc_I += local.double_occupancy(x), n_I += local.density(x);
+		if (green_blocks.empty() || green_blocks.back()[0]>=64) green_blocks.push_back(array<double, 4>{ { 0.0, 0.0, 0.0, 0.0, } });
+		array<double, 4> &b = green_blocks.back();
+		b[0] += 1.0;
+		b[1] += sign;
+		b[2] += sign*n_I;
+		b[3] += sign*kin;
+		Int.add(sign*sim.interaction_strength()*docc_I/V); // U acts on the interacting sites only
+		Docc.add(sign*docc/V);
+		if (bonds.empty()) {
+			const Eigen::MatrixXd &H = sim.interaction().lattice()->H;
+			for (size_t x=0;x<V && x<size_t(H.rows());x++)
+				for (size_t y=x+1;y<V && y<size_t(H.cols());y++)
+					if (H(x, y)!=0.0) bonds.push_back(make_pair(x, y));
+		}
+		if (!bonds.empty()) {
+			double szsz = 0.0;
+			for (const auto &b : bonds) szsz += local.spin_correlation(b.first, b.second);
+			SzSz.add(sign*szsz/bonds.size());
+		}
+		Verts.add(s.vertices);
 		//const int D = 4;
 		//int i = conf.current_slice();
-		if (gf.size()!=sim.configuration().slice_number()+1) gf.resize(sim.configuration().slice_number()+1);
-		sim.response_function(cache);
-		gf[sim.time_position()].add(sign*cache);
+		if (gf.size()!=s.slices+1) gf.resize(s.slices+1, matrix_measurement("Green Function", gf_levels, gf_error_level));
+		gf[s.time_position].add(sign, s.G_tau);
 		//double dt = (conf.slice_end()-conf.slice_start())/D;
 		//for (int j=0;j<D;j++) {
 			//conf.gf_tau(cache, j*dt);
 			//gf[D*i+j].add(cache);
 		//}
 	}
+	void merge (const Measurements &other) {
+		Sign.merge(other.Sign);
+		Dens.merge(other.Dens);
+		Kin.merge(other.Kin);
+		Int.merge(other.Int);
+		Docc.merge(other.Docc);
+		SzSz.merge(other.SzSz);
+		Verts.merge(other.Verts);
+		Order.merge(other.Order);
+		order_blocks.insert(order_blocks.end(), other.order_blocks.begin(), other.order_blocks.end());
+		green_blocks.insert(green_blocks.end(), other.green_blocks.begin(), other.green_blocks.end());
+		if (gf.size()<other.gf.size()) gf.resize(other.gf.size(), matrix_measurement("Green Function", gf_levels, gf_error_level));
+		for (size_t i=0;i<other.gf.size();i++) gf[i].merge(other.gf[i]);
+	}
+	// Estimators from the expansion order, per site of the whole lattice
+	// (see LCTSimulation::order): the interaction energy adds U n_I/2 with the
+	// density n_I of the Green function samples summed over the interacting
+	// sites, the total energy the kinetic energy of the same samples, both
+	// as ratios to the sign; C_int = <k^2> - <k>^2 - <k> is the interaction
+	// part of the specific heat (all of it only if the kinetic term commutes
+	// with the interaction). Errors by jackknife over up to 32 groups of
+	// blocks, leaving out the same fraction of both kinds of blocks.
+	void write_order (std::ostream &out, size_t V) {
+		if (order_blocks.empty()) return;
+		auto estimate = [&] (const array<double, 4> &t, const array<double, 4> &g) {
+			const double k = t[2]/t[1], k2 = t[3]/t[1];
+			const double n_I = g[0]>0.0?g[2]/g[1]:double(sites), kin = g[0]>0.0?g[3]/g[1]:0.0;
+			const double E_int = (shift-k/beta+0.5*U*n_I)/V;
+			return array<double, 3>{ { E_int, E_int+kin, (k2-k*k-k)/V, } };
+		};
+		array<double, 4> total{ { 0.0, 0.0, 0.0, 0.0, } }, green{ { 0.0, 0.0, 0.0, 0.0, } };
+		for (const auto &b : order_blocks) for (int i=0;i<4;i++) total[i] += b[i];
+		for (const auto &b : green_blocks) for (int i=0;i<4;i++) green[i] += b[i];
+		const array<double, 3> f = estimate(total, green);
+		size_t G = std::min(order_blocks.size(), size_t(32));
+		if (!green_blocks.empty()) G = std::min(G, green_blocks.size());
+		array<double, 3> error{ { 0.0, 0.0, 0.0, } };
+		for (size_t g=0;g<G && G>1;g++) {
+			array<double, 4> rest = total, green_rest = green;
+			for (size_t b=g*order_blocks.size()/G;b<(g+1)*order_blocks.size()/G;b++) for (int i=0;i<4;i++) rest[i] -= order_blocks[b][i];
+			for (size_t b=g*green_blocks.size()/G;b<(g+1)*green_blocks.size()/G;b++) for (int i=0;i<4;i++) green_rest[i] -= green_blocks[b][i];
+			const array<double, 3> fg = estimate(rest, green_rest);
+			for (int i=0;i<3;i++) error[i] += (fg[i]-f[i])*(fg[i]-f[i])*(G-1)/G;
+		}
+		out << "Interaction Energy (order): " << f[0] << " +- " << std::sqrt(error[0]) << endl;
+		out << "Total Energy (order): " << f[1] << " +- " << std::sqrt(error[1]) << endl;
+		out << "Specific Heat C_int (order): " << f[2] << " +- " << std::sqrt(error[2]) << endl;
+	}
 	void write_G (std::ostream &out) {
 		for (size_t i=0;i<gf.size();i++) {
 			out << gf[i].mean() << endl << endl;
@@ -60,36 +202,303 @@ class Measurements {
 	}
 };
 
-int main (int argc, char **argv) {
-	Parameters params(argc, argv);
+// Measures on a worker thread: the chain only copies its Green functions
+// into one of a few buffers and goes on, and waits only when all of them
+// are pending. The samples are added in order, so the results are the same
+// as with Measurements::measure.
+class MeasurementPipeline {
+	Measurements &measurements_;
+	Pipeline<Sample> pipeline;
+	public:
+	MeasurementPipeline (Measurements &measurements, size_t buffers)
+		: measurements_(measurements), pipeline(buffers, [&measurements] (Sample &s) { measurements.add(s); }) {}
+	// cheap enough for the chain's thread
+	void measure_order (const LCTSimulation &sim) { measurements_.measure_order(sim); }
+	void measure (const LCTSimulation &sim) {
+		pipeline.acquire().take(sim);
+		pipeline.submit();
+	}
+	// to be called before reading the measurements
+	void flush () { pipeline.flush(); }
+};
+
+// watches the sign, the expansion order and the density of a chain during
+// thermalization; with --auto_thermalization the thermalization ends when
+// they are stationary, and the thermalization sweeps are only a cap
+class Thermalization {
+	EquilibrationDetector detector;
+	public:
+	Thermalization (size_t cap) : detector(cap/10) {
+		detector.add_observable("sign");
+		detector.add_observable("vertices");
+		detector.add_observable("density");
+	}
+	bool stationary (const LCTSimulation &sim) {
+		detector.add(0, sim.sign());
+		detector.add(1, sim.vertices());
+		detector.add(2, sim.sign()*sim.green_function().trace()/sim.volume());
+		return detector.check();
+	}
+	bool stationary () const { return detector.equilibrated(); }
+	std::string status () const { return detector.status().empty()?"too few sweeps to check":detector.status(); }
+};
+
+// splits a comma separated list as given on the command line
+vector<std::string> parse_list (const std::string &list) {
+	vector<std::string> ret;
+	for (size_t i=0;i<list.size();) {
+		size_t j = list.find(',', i);
+		if (j==std::string::npos) j = list.size();
+		ret.push_back(list.substr(i, j-i));
+		i = j+1;
+	}
+	return ret;
+}
+
+// one full sweep (both directions) of sim, measuring if requested: the
+// expansion order at every step, the Green functions only if green is set
+template <typename M>
+void full_sweep (LCTSimulation &sim, M &measurements, bool measure, bool green = true) {
+	for (size_t j=0;j<sim.full_sweep_size();j++) {
+		sim.prepare();
+		sim.sweep();
+		sim.next();
+		if (measure) measurements.measure_order(sim);
+		if (measure && green) measurements.measure(sim);
+	}
+}
+
+// Replica exchange along a ladder of interaction strengths, e.g.
+// --U_ladder 2,3,4,5. K, beta and the slices are shared by all replicas, so
+// the combinatorial factors of a vertex configuration are the same on every
+// rung and a swap is accepted with the ratio of the determinants alone:
+//   exp(P_i(C_j) + P_j(C_i) - P_i(C_i) - P_j(C_j))
+// where P_i(C) is probability() of configuration C at U_i. Every
+// --exchange_interval sweeps the replicas on neighbouring rungs (even and
+// odd pairs in turn) evaluate each other's U in parallel; instead of moving
+// configurations, accepted pairs exchange their U values. Measurements
+// belong to the rungs.
+int tempering (const Parameters &params) {
 	size_t thermalization = params.getInteger("thermalization", 1000);
 	size_t sweeps = params.getInteger("sweeps", 1000);
-	LCTSimulation sim(params);
-	Measurements measurements;
-	for (size_t i=0;i<thermalization+sweeps;i++) {
-		//sim.full_sweep(false);
-		for (size_t j=0;j<sim.full_sweep_size();j++) {
-			//std::cerr << "dp = " << sim.exact_probability()-sim.probability() << ' ' << sim.probability_difference() << ' ' << j << ' ' << sim.is_direction_right_to_left() << endl << endl;
-			sim.prepare();
-			sim.sweep();
-			sim.next();
-			if (i>=thermalization) {
-				measurements.measure(sim);
+	size_t interval = std::max(params.getInteger("exchange_interval", 1), 1);
+	size_t measure_interval = std::max(params.getInteger("measure_interval", 1), 1);
+	vector<double> ladder;
+	for (const std::string &x : parse_list(params.getString("U_ladder"))) ladder.push_back(atof(x.c_str()));
+	const int R = ladder.size();
+	int threads = std::max(params.getInteger("threads", R), 1);
+	LCTSimulation::Interaction model(params);
+	vector<unique_ptr<LCTSimulation>> sims(R);
+	vector<int> rung(R); // rung of each replica
+	vector<int> replica(R); // replica on each rung
+	vector<Measurements> measurements(R, Measurements(params.getInteger("gf_levels", 16), params.getInteger("gf_error_level", -1)));
+	vector<double> own(R), other(R);
+	vector<int> partner(R);
+	vector<long> attempted(R, 0), accepted(R, 0); // for the pair (k, k+1)
+	Philox generator(params.getInteger("SEED", 42), R); // the stream after those of the replicas
+	std::uniform_real_distribution<double> d;
+	ThreadPool pool(std::min(threads, R));
+	pool.parallel_for(R, [&] (int r, int) {
+		sims[r].reset(new LCTSimulation(params, model, r));
+		sims[r]->set_interaction_strength(ladder[r]);
+	});
+	for (int r=0;r<R;r++) rung[r] = replica[r] = r;
+	for (size_t i=0;i<thermalization+sweeps;i+=interval) {
+		pool.parallel_for(R, [&] (int r, int) {
+			for (size_t k=i;k<i+interval && k<thermalization+sweeps;k++) {
+				full_sweep(*sims[r], measurements[rung[r]], k>=thermalization, (k-thermalization)%measure_interval==0);
+			}
+		});
+		// pair the rungs (k, k+1) with k of the parity of this round
+		for (int r=0;r<R;r++) {
+			int k = rung[r];
+			partner[r] = -1;
+			if (k%2==int(i/interval)%2 && k+1<R) partner[r] = replica[k+1];
+			else if (k%2!=int(i/interval)%2 && k>0) partner[r] = replica[k-1];
+		}
+		pool.parallel_for(R, [&] (int r, int) {
+			if (partner[r]<0) return;
+			own[r] = sims[r]->probability();
+			sims[r]->set_interaction_strength(ladder[rung[partner[r]]]);
+			other[r] = sims[r]->probability();
+		});
+		for (int k=int(i/interval)%2;k+1<R;k+=2) {
+			int r = replica[k], s = replica[k+1];
+			attempted[k]++;
+			if (std::log(d(generator))<other[r]+other[s]-own[r]-own[s]) {
+				accepted[k]++;
+				std::swap(rung[r], rung[s]);
+				std::swap(replica[k], replica[k+1]);
+				partner[r] = partner[s] = -1;
 			}
 		}
-		if (i>=thermalization) {
-			if (i%100==0) cerr << endl << measurements.Kin << endl << measurements.Int << endl << measurements.Sign << endl;
-		} else if (i%100==0) {
+		pool.parallel_for(R, [&] (int r, int) {
+			if (partner[r]<0) return;
+			sims[r]->set_interaction_strength(ladder[rung[r]]);
+		});
+		if (i%100<interval && i<thermalization) {
 			cerr << ' ' << (100.0*i/thermalization) << "%         \r";
 		}
-		//conf.compute_B();
-		//double p2 = conf.probability().first;
-		//std::cerr << i << " dp = " << p1+pr-p2 << ' ' << p2-p1 << ' ' << pr << endl;
 	}
+	for (int k=0;k<R;k++) {
+		cerr << endl << "U = " << ladder[k] << endl;
+		cerr << measurements[k].Kin << endl << measurements[k].Int << endl << measurements[k].Sign << endl << measurements[k].Verts << endl;
+		measurements[k].write_order(cerr, sims[0]->volume());
+		if (k+1<R) cerr << "exchange acceptance U = " << ladder[k] << " <-> " << ladder[k+1] << ": " << double(accepted[k])/std::max(attempted[k], 1l) << endl;
+		ofstream dens("dens_" + std::to_string(k) + ".dat");
+		dens << measurements[k].Dens.mean() << endl << endl;
+	}
+	return 0;
+}
+
+// Parameter scan, e.g. --scan beta --scan_values 1,2,4,8. The points are
+// run in the given order and each one starts from the final vertices of the
+// previous point (stretched in time if beta changes), so only the first
+// point pays the full thermalization and the others use
+// --warm_thermalization sweeps (a quarter by default). Unless H or K are
+// scanned all points share the lattice data; if a scanned H has fewer
+// sites, the vertices on the missing sites are dropped.
+int scan (const Parameters &params) {
+	size_t thermalization = params.getInteger("thermalization", 1000);
+	size_t warm_thermalization = params.getInteger("warm_thermalization", thermalization/4);
+	size_t sweeps = params.getInteger("sweeps", 1000);
+	bool automatic = params.getInteger("auto_thermalization", 0);
+	size_t buffers = params.getInteger("measurement_buffers", 0);
+	size_t interval = std::max(params.getInteger("measure_interval", 1), 1);
+	const std::string name = params.getString("scan");
+	vector<std::string> values = parse_list(params.getString("scan_values"));
+	LCTSimulation::Interaction model(params);
+	unique_ptr<LCTSimulation> previous;
+	for (size_t k=0;k<values.size();k++) {
+		Parameters p = params;
+		p.setString(name, values[k]);
+		LCTSimulation::Interaction point_model = (name=="H" || name=="K")?LCTSimulation::Interaction(p):model;
+		point_model.set_interaction_strength(p.getNumber("U", 4.0));
+		unique_ptr<LCTSimulation> sim(new LCTSimulation(p, point_model, 0));
+		if (previous) sim->warm_start(*previous);
+		Measurements measurements(p.getInteger("gf_levels", 16), p.getInteger("gf_error_level", -1));
+		size_t n = previous?warm_thermalization:thermalization;
+		Thermalization monitor(n);
+		for (size_t i=0;i<n;i++) {
+			full_sweep(*sim, measurements, false);
+			if (automatic && i+1<n && monitor.stationary(*sim)) n = i+1;
+		}
+		if (buffers>0) {
+			MeasurementPipeline pipeline(measurements, buffers);
+			for (size_t i=0;i<sweeps;i++) full_sweep(*sim, pipeline, true, i%interval==0);
+		} else {
+			for (size_t i=0;i<sweeps;i++) full_sweep(*sim, measurements, true, i%interval==0);
+		}
+		cerr << endl << name << " = " << values[k] << endl;
+		if (automatic && !monitor.stationary()) cerr << "not stationary at the thermalization cap: " << n << " sweeps, " << monitor.status() << endl;
+		else if (automatic) cerr << "thermalization: " << n << " sweeps, " << monitor.status() << endl;
+		cerr << measurements.Kin << endl << measurements.Int << endl << measurements.Sign << endl << measurements.Verts << endl;
+		measurements.write_order(cerr, sim->volume());
+		ofstream dens("dens_" + std::to_string(k) + ".dat");
+		dens << measurements.Dens.mean() << endl << endl;
+		previous = std::move(sim);
+	}
+	return 0;
+}
+
+// runs --chains independent Markov chains on --threads threads, or the
+// replica exchange or the scan above if --U_ladder or --scan are given. All chains
+// share the lattice data (hopping matrix and its eigendecomposition) of one
+// model instance; the measurements are merged bin by bin at the end.
+// With --fork 1 a single chain is thermalized first and every chain starts
+// from its final vertices with its own random stream, running only
+// --decorrelation sweeps (a tenth of the thermalization by default) before
+// measuring. With --measurement_buffers n>0 every chain and every scan point
+// evaluates its observables on a worker thread through n buffers. The
+// expansion order is measured at every step, the Green functions only every
+// --measure_interval sweeps.
+int main (int argc, char **argv) {
+	Parameters params(argc, argv);
+	if (params.contains("U_ladder")) return tempering(params);
+	if (params.contains("scan")) return scan(params);
+	size_t thermalization = params.getInteger("thermalization", 1000);
+	size_t sweeps = params.getInteger("sweeps", 1000);
+	bool automatic = params.getInteger("auto_thermalization", 0);
+	int chains = std::max(params.getInteger("chains", 1), 1);
+	int threads = std::max(params.getInteger("threads", chains), 1);
+	bool fork = params.getInteger("fork", 0);
+	size_t decorrelation = params.getInteger("decorrelation", thermalization/10);
+	size_t buffers = params.getInteger("measurement_buffers", 0);
+	size_t interval = std::max(params.getInteger("measure_interval", 1), 1);
+	LCTSimulation::Interaction model(params);
+	vector<unique_ptr<LCTSimulation>> sims(chains);
+	Logger log(cerr);
+	vector<Measurements> chain_measurements(chains, Measurements(params.getInteger("gf_levels", 16), params.getInteger("gf_error_level", -1)));
+	unique_ptr<LCTSimulation> parent;
+	if (fork) {
+		// its stream differs from those of all the chains forked from it
+		parent.reset(new LCTSimulation(params, model, chains));
+		size_t n = thermalization;
+		Thermalization monitor(n);
+		for (size_t i=0;i<n;i++) {
+			full_sweep(*parent, chain_measurements[0], false);
+			if (automatic && i+1<n && monitor.stationary(*parent)) {
+				n = i+1;
+				cerr << endl << "thermalized after " << n << " sweeps: " << monitor.status() << endl;
+			}
+			if (i%100==0) cerr << ' ' << (100.0*i/n) << "%         \r";
+		}
+		if (automatic && !monitor.stationary()) cerr << endl << "not stationary at the thermalization cap: " << monitor.status() << endl;
+		cerr << endl << "forking " << chains << " chains after " << n << " thermalization sweeps" << endl;
+	}
+	ThreadPool pool(std::min(threads, chains));
+	pool.parallel_for(chains, [&] (int c, int) {
+		sims[c].reset(parent?new LCTSimulation(params, model, c, *parent):new LCTSimulation(params, model, c));
+		LCTSimulation &sim = *sims[c];
+		Measurements &measurements = chain_measurements[c];
+		unique_ptr<MeasurementPipeline> pipeline;
+		if (buffers>0) pipeline.reset(new MeasurementPipeline(measurements, buffers));
+		size_t n = parent?decorrelation:thermalization;
+		Thermalization monitor(n);
+		for (size_t i=0;i<n+sweeps;i++) {
+			//sim.full_sweep(false);
+			for (size_t j=0;j<sim.full_sweep_size();j++) {
+				//std::cerr << "dp = " << sim.exact_probability()-sim.probability() << ' ' << sim.probability_difference() << ' ' << j << ' ' << sim.is_direction_right_to_left() << endl << endl;
+				sim.prepare();
+				sim.sweep();
+				sim.next();
+				if (i>=n && pipeline) {
+					pipeline->measure_order(sim);
+					if ((i-n)%interval==0) pipeline->measure(sim);
+				} else if (i>=n) {
+					measurements.measure_order(sim);
+					if ((i-n)%interval==0) measurements.measure(sim);
+				}
+			}
+			if (automatic && !parent && i+1<n && monitor.stationary(sim)) {
+				n = i+1;
+				cerr << endl << "chain " << c << " thermalized after " << n << " sweeps: " << monitor.status() << endl;
+			} else if (automatic && !parent && i+1==n && !monitor.stationary()) {
+				cerr << endl << "chain " << c << " not stationary at the thermalization cap: " << monitor.status() << endl;
+			}
+			if (c!=0) continue;
+			if (i>=n) {
+				if (i%100==0 && pipeline) pipeline->flush();
+				if (i%100==0) cerr << endl << measurements.Kin << endl << measurements.Int << endl << measurements.Sign << endl;
+				if (i%100==0) timers::report_every(log, 60.0);
+			} else if (i%100==0) {
+				cerr << ' ' << (100.0*i/n) << "%         \r";
+			}
+			//conf.compute_B();
+			//double p2 = conf.probability().first;
+			//std::cerr << i << " dp = " << p1+pr-p2 << ' ' << p2-p1 << ' ' << pr << endl;
+		}
+	});
+	Measurements &measurements = chain_measurements[0];
+	for (int c=1;c<chains;c++) measurements.merge(chain_measurements[c]);
+	LCTSimulation &sim = *sims[0];
 	//double p2 = sim.exact_probability();
 	cerr << endl << measurements.Kin << endl << measurements.Int << endl << measurements.Sign << endl;
+	cerr << measurements.Docc << endl << measurements.SzSz << endl;
+	measurements.write_order(cerr, sim.volume());
 	cerr << endl << measurements.Dens.mean().matrix().trace() << endl << endl;
 	std::cerr << "dp = " << sim.exact_probability()-sim.probability() << ' ' << sim.probability() << endl << endl;
+	timers::report(log);
 	ofstream out("gf.dat");
 	Eigen::MatrixXd ev = sim.configuration().eigenvectors();
 	measurements.write_G(out, ev);
@@ -0,0 +1,74 @@
+#ifndef GREEN_FUNCTION_IO_HPP
+#define GREEN_FUNCTION_IO_HPP
+
+#include "binary_io.hpp"
+
+#include <string>
+#include <cstring>
+#include <cstdint>
+
+// Binary Green's function file. A fixed header is followed by four
+// contiguous blocks of (N+1)*V*V doubles: G_up, DG_up, G_dn, DG_dn.
+// Each block is indexed [t][x][y] with y running fastest, and every
+// quantity is in units of tx, as in the Lua output.
+struct GreenFunctionHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t header_size;
+	double beta;
+	double dtau;
+	double mu;
+	double B;
+	double U;
+	int32_t Lx, Ly, Lz;
+	int32_t N; // number of time slices, the blocks hold N+1 of them
+	int32_t V;
+	int32_t reserved;
+	double sign;
+	double dsign;
+	uint64_t data_offset; // aligned so that the blocks can be used in place from a mapping
+
+	static const uint32_t current_version = 1;
+
+	static const char *expected_magic () { return "QMCGF\0\0\0"; }
+
+	GreenFunctionHeader () : version(current_version), header_size(sizeof(GreenFunctionHeader)),
+		beta(0.0), dtau(0.0), mu(0.0), B(0.0), U(0.0), Lx(0), Ly(0), Lz(0), N(0), V(0), reserved(0),
+		sign(0.0), dsign(0.0), data_offset((sizeof(GreenFunctionHeader)+63)/64*64) {
+		std::memcpy(magic, expected_magic(), sizeof(magic));
+	}
+
+	size_t block_size () const { return size_t(N+1)*V*V; }
+};
+
+inline bool is_binary_green_function (const std::string &fn) {
+	return binary_has_magic(fn, GreenFunctionHeader::expected_magic(), 8);
+}
+
+// Read-only view of a binary Green's function file, backed by a memory map.
+class GreenFunctionFile {
+	private:
+		BinaryInput in_;
+		GreenFunctionHeader header_;
+		const double *block (int i) const {
+			return reinterpret_cast<const double *>(in_.data()+header_.data_offset) + i*header_.block_size();
+		}
+	public:
+		bool open (const std::string &fn) {
+			if (!in_.open(fn, true)) return false;
+			if (!in_.read(header_)) return false;
+			if (std::memcmp(header_.magic, GreenFunctionHeader::expected_magic(), 8)!=0) return false;
+			if (header_.version!=GreenFunctionHeader::current_version) return false;
+			if (header_.N<0 || header_.V<0) return false;
+			return in_.size()>=header_.data_offset+4*header_.block_size()*sizeof(double);
+		}
+
+		const GreenFunctionHeader &header () const { return header_; }
+		const double *G_up () const { return block(0); }
+		const double *DG_up () const { return block(1); }
+		const double *G_dn () const { return block(2); }
+		const double *DG_dn () const { return block(3); }
+};
+
+#endif // GREEN_FUNCTION_IO_HPP
+
@@ -3,9 +3,11 @@
 
 #include "parameters.hpp"
 #include "modelbase.hpp"
+#include "philox.hpp"
 
 #include <Eigen/Dense>
 #include <random>
+#include <memory>
 
 // FIXME
 #include <iostream>
@@ -42,6 +44,15 @@ inline std::ostream &operator<< (std::ostream &f, HubbardVertex v) {
 	return f;
 }
 
+// Single particle data of the lattice: the hopping matrix and its
+// eigendecomposition. It is immutable once built, so every copy of a
+// HubbardInteraction (e.g. one per Markov chain) shares the same instance.
+struct HubbardLattice {
+	Eigen::MatrixXd H;
+	Eigen::VectorXd eigenvalues;
+	Eigen::MatrixXd eigenvectors;
+};
+
 //
 // class HubbardInteraction
 //
@@ -63,9 +74,7 @@ inline std::ostream &operator<< (std::ostream &f, HubbardVertex v) {
 //
 template <bool UseSpinBlocks = false>
 class HubbardInteraction : ModelBase {
-	Eigen::MatrixXd H;
-	Eigen::VectorXd eigenvalues_;
-	Eigen::MatrixXd eigenvectors_;
+	std::shared_ptr<const HubbardLattice> lattice_;
 	double U;
 	double K;
 	size_t N;
@@ -81,8 +90,8 @@ class HubbardInteraction : ModelBase {
 	public:
 	typedef HubbardVertex Vertex;
 	typedef HubbardVertexMatrix MatrixType;
-	HubbardInteraction () : coin_flip(0.5), random_time(0.0, 1.0) {}
-	HubbardInteraction (const Parameters &p) : coin_flip(0.5), random_time(0.0, 1.0) { setup(p); }
+	HubbardInteraction () : lattice_(std::make_shared<HubbardLattice>()), coin_flip(0.5), random_time(0.0, 1.0) {}
+	HubbardInteraction (const Parameters &p) : lattice_(std::make_shared<HubbardLattice>()), coin_flip(0.5), random_time(0.0, 1.0) { setup(p); }
 	//HubbardInteraction (const HubbardInteraction &other) : coin_flip(0.5), random_time(0.0, 1.0) { setup(other.U, other.K); }
 
 	//inline void setup (double u, double k) {
@@ -94,6 +103,8 @@ class HubbardInteraction : ModelBase {
 
 	inline void setup (const Parameters &p) {
 		if (p.contains("H")) {
+			std::shared_ptr<HubbardLattice> lattice = std::make_shared<HubbardLattice>();
+			Eigen::MatrixXd &H = lattice->H;
 			std::string fn = p.getString("H");
 			std::ifstream in(fn);
 			in >> V;
@@ -107,18 +118,19 @@ class HubbardInteraction : ModelBase {
 			}
 			Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> solver(H);
 			if (UseSpinBlocks) {
-				eigenvectors_ = Eigen::MatrixXd::Zero(2*V, 2*V);
-				eigenvectors_.block(0, 0, V, V) = solver.eigenvectors();
-				eigenvectors_.block(V, V, V, V) = solver.eigenvectors();
-				eigenvalues_.setZero(2*V);
-				eigenvalues_.head(V) = solver.eigenvalues();
-				eigenvalues_.tail(V) = solver.eigenvalues();
+				lattice->eigenvectors = Eigen::MatrixXd::Zero(2*V, 2*V);
+				lattice->eigenvectors.block(0, 0, V, V) = solver.eigenvectors();
+				lattice->eigenvectors.block(V, V, V, V) = solver.eigenvectors();
+				lattice->eigenvalues.setZero(2*V);
+				lattice->eigenvalues.head(V) = solver.eigenvalues();
+				lattice->eigenvalues.tail(V) = solver.eigenvalues();
 				V = V;
 			} else {
-				eigenvalues_ = solver.eigenvalues();
-				eigenvectors_ = solver.eigenvectors();
+				lattice->eigenvalues = solver.eigenvalues();
+				lattice->eigenvectors = solver.eigenvectors();
 				V /= 2;
 			}
+			lattice_ = lattice;
 		} else {
 		}
 		N = 2*V;
@@ -130,8 +142,11 @@ class HubbardInteraction : ModelBase {
 		b = sqrt(U/K+a*a);
 	}
 
+	// the setters copy the lattice data instead of modifying the shared instance
 	void set_lattice_eigenvectors (const Eigen::MatrixXd &A) {
-		eigenvectors_ = A;
+		std::shared_ptr<HubbardLattice> lattice = std::make_shared<HubbardLattice>(*lattice_);
+		lattice->eigenvectors = A;
+		lattice_ = lattice;
 		N = A.diagonal().size();
 		V = N/2; // FIXME assert N even?
 		I = V;
@@ -139,7 +154,9 @@ class HubbardInteraction : ModelBase {
 	}
 
 	void set_lattice_eigenvalues (const Eigen::VectorXd &v) {
-		eigenvalues_ = v;
+		std::shared_ptr<HubbardLattice> lattice = std::make_shared<HubbardLattice>(*lattice_);
+		lattice->eigenvalues = v;
+		lattice_ = lattice;
 	}
 
 	void set_interactive_sites (size_t i) {
@@ -153,7 +170,7 @@ class HubbardInteraction : ModelBase {
 	}
 
 	Vertex generate (double t0, double t1) {
-		std::mt19937_64 g;
+		Philox g;
 		return generate(t0, t1, g);
 	}
 
@@ -168,12 +185,12 @@ class HubbardInteraction : ModelBase {
 	}
 
 	void prepare (Vertex &v) {
-		cached_vec = eigenvalues_;
+		cached_vec = lattice_->eigenvalues;
 		cached_vec *= -v.tau;
 		cached_vec = cached_vec.array().exp();
 		v.data.U.resize(N, 2);
-		v.data.U.col(0) = eigenvectors_.row(v.x).transpose();
-		v.data.U.col(1) = eigenvectors_.row(v.x+V).transpose();
+		v.data.U.col(0) = lattice_->eigenvectors.row(v.x).transpose();
+		v.data.U.col(1) = lattice_->eigenvectors.row(v.x+V).transpose();
 		v.data.V = v.data.U;
 		v.data.U.array().colwise() /= cached_vec.array();
 		v.data.V.array().colwise() *= cached_vec.array();
@@ -188,26 +205,26 @@ class HubbardInteraction : ModelBase {
 
 	template <typename T>
 	void apply_vertex_on_the_left (const Vertex &v, T &M) {
-		M += (a+v.sigma) * eigenvectors_.row(v.x).transpose() * (eigenvectors_.row(v.x) * M)
-			+ (a-v.sigma) * eigenvectors_.row(v.x+V).transpose() * (eigenvectors_.row(v.x+V) * M);
+		M += (a+v.sigma) * lattice_->eigenvectors.row(v.x).transpose() * (lattice_->eigenvectors.row(v.x) * M)
+			+ (a-v.sigma) * lattice_->eigenvectors.row(v.x+V).transpose() * (lattice_->eigenvectors.row(v.x+V) * M);
 	}
 
 	template <typename T>
 	void apply_vertex_on_the_right (const Vertex &v, T &M) {
-		M += (a+v.sigma) * (M * eigenvectors_.row(v.x).transpose()) * eigenvectors_.row(v.x)
-			+ (a-v.sigma) * (M * eigenvectors_.row(v.x+V).transpose()) * eigenvectors_.row(v.x+V);
+		M += (a+v.sigma) * (M * lattice_->eigenvectors.row(v.x).transpose()) * lattice_->eigenvectors.row(v.x)
+			+ (a-v.sigma) * (M * lattice_->eigenvectors.row(v.x+V).transpose()) * lattice_->eigenvectors.row(v.x+V);
 	}
 
 	template <typename T>
 	void apply_inverse_on_the_left (const Vertex &v, T &M) {
-		M -= (a+v.sigma)/(1.0+a+v.sigma) * eigenvectors_.row(v.x).transpose() * (eigenvectors_.row(v.x) * M)
-			+ (a-v.sigma)/(1.0+a-v.sigma) * eigenvectors_.row(v.x+V).transpose() * (eigenvectors_.row(v.x+V) * M);
+		M -= (a+v.sigma)/(1.0+a+v.sigma) * lattice_->eigenvectors.row(v.x).transpose() * (lattice_->eigenvectors.row(v.x) * M)
+			+ (a-v.sigma)/(1.0+a-v.sigma) * lattice_->eigenvectors.row(v.x+V).transpose() * (lattice_->eigenvectors.row(v.x+V) * M);
 	}
 
 	template <typename T>
 	void apply_inverse_on_the_right (const Vertex &v, T &M) {
-		M -= (a+v.sigma)/(1.0+a+v.sigma) * (M * eigenvectors_.row(v.x).transpose()) * eigenvectors_.row(v.x)
-			+ (a-v.sigma)/(1.0+a-v.sigma) * (M * eigenvectors_.row(v.x+V).transpose()) * eigenvectors_.row(v.x+V);
+		M -= (a+v.sigma)/(1.0+a+v.sigma) * (M * lattice_->eigenvectors.row(v.x).transpose()) * lattice_->eigenvectors.row(v.x)
+			+ (a-v.sigma)/(1.0+a-v.sigma) * (M * lattice_->eigenvectors.row(v.x+V).transpose()) * lattice_->eigenvectors.row(v.x+V);
 	}
 
 	template <typename T>
@@ -246,9 +263,25 @@ class HubbardInteraction : ModelBase {
 	double scalarA () const { return a; }
 	double scalarB () const { return b; }
 
+	// changes U at fixed K: existing vertices must be rebuilt with remap()
+	void set_interaction_strength (double u) {
+		U = u;
+		a = 1.0*U/2.0/K;
+		b = sqrt(U/K+a*a);
+	}
+
+	double interaction_strength () const { return U; }
+
+	// the same vertex (site, time and spin) for the current U
+	void remap (Vertex &v) {
+		v.sigma = v.sigma>0.0?(+b):(-b);
+		prepare(v);
+	}
+
 	double log_abs_det (const Vertex &v) const { return 0.0; }
 	double log_abs_det_block (const Vertex &v, size_t i) const { return std::log(std::fabs(i==0?(1.0+a+v.sigma):(1.0+a-v.sigma))); }
 	double combinatorial_factor () { return log(K*interacting_sites()); }
+	double expansion_constant () const { return K; }
 
 	size_t blocks () const { return UseSpinBlocks?2:1; }
 	size_t block_start (size_t i) const { return UseSpinBlocks?(i==0?0:volume()):0; }
@@ -256,32 +289,40 @@ class HubbardInteraction : ModelBase {
 
 	template <typename T>
 	double kinetic_energy (const T &M) const {
-		return (eigenvalues_.array() * M.diagonal().array()).sum();
+		return (lattice_->eigenvalues.array() * M.diagonal().array()).sum();
 	}
 
+	// only the real-space diagonal of M is needed: (U M U^t)_ii = (U M)_i. U_i.
+	// costs one product per spin block instead of two full products
 	template <typename T>
 	double interaction_energy (const T &M) const {
-		Eigen::ArrayXd d = (eigenvectors_ * M * eigenvectors_.transpose()).diagonal();
+		Eigen::ArrayXd d(N);
+		for (size_t i=0;i<blocks();i++) {
+			const size_t s = block_start(i), n = block_size(i);
+			const auto E = lattice_->eigenvectors.block(s, s, n, n);
+			d.segment(s, n) = ((E*M.block(s, s, n, n).matrix()).array()*E.array()).rowwise().sum();
+		}
 		return U * (d.head(V)*d.tail(V)).sum();
 	}
 
-	Eigen::VectorXd eigenvalues () const { return eigenvalues_; }
-	Eigen::MatrixXd eigenvectors () const { return eigenvectors_; }
+	const Eigen::VectorXd &eigenvalues () const { return lattice_->eigenvalues; }
+	const Eigen::MatrixXd &eigenvectors () const { return lattice_->eigenvectors; }
+	const std::shared_ptr<const HubbardLattice> &lattice () const { return lattice_; }
 
 	template <typename T>
 	void propagate (double t, T& M) {
-		cached_vec = eigenvalues_;
+		cached_vec = lattice_->eigenvalues;
 		cached_vec *= -t;
 		cached_vec = cached_vec.array().exp();
-		M.array().colwise() *= cached_vec.array(); // (-t*eigenvalues_.array()).exp(); // this causes allocation!
+		M.array().colwise() *= cached_vec.array(); // (-t*lattice_->eigenvalues.array()).exp(); // this causes allocation!
 	}
 
 	template <typename T>
 		void propagate_on_the_right (double t, T& M) {
-		cached_vec = eigenvalues_;
+		cached_vec = lattice_->eigenvalues;
 		cached_vec *= -t;
 		cached_vec = cached_vec.array().exp();
-		M.array().rowwise() *= cached_vec.transpose().array(); // (-t*eigenvalues_.array()).exp(); // this causes allocation!
+		M.array().rowwise() *= cached_vec.transpose().array(); // (-t*lattice_->eigenvalues.array()).exp(); // this causes allocation!
 	}
 
 	typedef HubbardInteraction Interaction;
@@ -291,50 +332,50 @@ class HubbardInteraction : ModelBase {
 
 template <> template <>
 inline void HubbardInteraction<true>::apply_vertex_on_the_left (const Vertex &v, Eigen::MatrixXd &M) {
-	cached_vec.noalias() = M.block(0, 0, V, V).transpose() * eigenvectors_.block(0, 0, V, V).row(v.x).transpose();
-	M.block(0, 0, V, V).noalias() += (a+v.sigma) * eigenvectors_.block(0, 0, V, V).row(v.x).transpose() * cached_vec.transpose();
-	cached_vec.noalias() = M.block(V, V, V, V).transpose() * eigenvectors_.block(V, V, V, V).row(v.x).transpose();
-	M.block(V, V, V, V).noalias() += (a-v.sigma) * eigenvectors_.block(V, V, V, V).row(v.x).transpose() * cached_vec.transpose();
+	cached_vec.noalias() = M.block(0, 0, V, V).transpose() * lattice_->eigenvectors.block(0, 0, V, V).row(v.x).transpose();
+	M.block(0, 0, V, V).noalias() += (a+v.sigma) * lattice_->eigenvectors.block(0, 0, V, V).row(v.x).transpose() * cached_vec.transpose();
+	cached_vec.noalias() = M.block(V, V, V, V).transpose() * lattice_->eigenvectors.block(V, V, V, V).row(v.x).transpose();
+	M.block(V, V, V, V).noalias() += (a-v.sigma) * lattice_->eigenvectors.block(V, V, V, V).row(v.x).transpose() * cached_vec.transpose();
 }
 
 template <> template <>
 inline void HubbardInteraction<true>::apply_vertex_on_the_right (const Vertex &v, Eigen::MatrixXd &M) {
-	cached_vec.noalias() = M.block(0, 0, V, V) * eigenvectors_.block(0, 0, V, V).row(v.x).transpose();
-	M.block(0, 0, V, V).noalias() += (a+v.sigma) * cached_vec * eigenvectors_.block(0, 0, V, V).row(v.x);
-	cached_vec.noalias() = M.block(V, V, V, V) * eigenvectors_.block(V, V, V, V).row(v.x).transpose();
-	M.block(V, V, V, V).noalias() += (a-v.sigma) * cached_vec * eigenvectors_.block(V, V, V, V).row(v.x);
+	cached_vec.noalias() = M.block(0, 0, V, V) * lattice_->eigenvectors.block(0, 0, V, V).row(v.x).transpose();
+	M.block(0, 0, V, V).noalias() += (a+v.sigma) * cached_vec * lattice_->eigenvectors.block(0, 0, V, V).row(v.x);
+	cached_vec.noalias() = M.block(V, V, V, V) * lattice_->eigenvectors.block(V, V, V, V).row(v.x).transpose();
+	M.block(V, V, V, V).noalias() += (a-v.sigma) * cached_vec * lattice_->eigenvectors.block(V, V, V, V).row(v.x);
 }
 
 template <> template <>
 inline void HubbardInteraction<true>::apply_inverse_on_the_left (const Vertex &v, Eigen::MatrixXd &M) {
-	cached_vec.noalias() = M.block(0, 0, V, V).transpose() * eigenvectors_.block(0, 0, V, V).row(v.x).transpose();
-	M.block(0, 0, V, V).noalias() -= (a+v.sigma)/(1.0+a+v.sigma) * eigenvectors_.block(0, 0, V, V).row(v.x).transpose() * cached_vec.transpose();
-	cached_vec.noalias() = M.block(V, V, V, V).transpose() * eigenvectors_.block(V, V, V, V).row(v.x).transpose();
-	M.block(V, V, V, V).noalias() -= (a-v.sigma)/(1.0+a-v.sigma) * eigenvectors_.block(V, V, V, V).row(v.x).transpose() * cached_vec.transpose();
+	cached_vec.noalias() = M.block(0, 0, V, V).transpose() * lattice_->eigenvectors.block(0, 0, V, V).row(v.x).transpose();
+	M.block(0, 0, V, V).noalias() -= (a+v.sigma)/(1.0+a+v.sigma) * lattice_->eigenvectors.block(0, 0, V, V).row(v.x).transpose() * cached_vec.transpose();
+	cached_vec.noalias() = M.block(V, V, V, V).transpose() * lattice_->eigenvectors.block(V, V, V, V).row(v.x).transpose();
+	M.block(V, V, V, V).noalias() -= (a-v.sigma)/(1.0+a-v.sigma) * lattice_->eigenvectors.block(V, V, V, V).row(v.x).transpose() * cached_vec.transpose();
 }
 
 template <> template <>
 inline void HubbardInteraction<true>::apply_inverse_on_the_right (const Vertex &v, Eigen::MatrixXd &M) {
-	cached_vec.noalias() = M.block(0, 0, V, V) * eigenvectors_.block(0, 0, V, V).row(v.x).transpose();
-	M.block(0, 0, V, V).noalias() -= (a+v.sigma)/(1.0+a+v.sigma) * cached_vec * eigenvectors_.block(0, 0, V, V).row(v.x);
-	cached_vec.noalias() = M.block(V, V, V, V) * eigenvectors_.block(V, V, V, V).row(v.x).transpose();
-	M.block(V, V, V, V).noalias() -= (a-v.sigma)/(1.0+a-v.sigma) * cached_vec * eigenvectors_.block(V, V, V, V).row(v.x);
+	cached_vec.noalias() = M.block(0, 0, V, V) * lattice_->eigenvectors.block(0, 0, V, V).row(v.x).transpose();
+	M.block(0, 0, V, V).noalias() -= (a+v.sigma)/(1.0+a+v.sigma) * cached_vec * lattice_->eigenvectors.block(0, 0, V, V).row(v.x);
+	cached_vec.noalias() = M.block(V, V, V, V) * lattice_->eigenvectors.block(V, V, V, V).row(v.x).transpose();
+	M.block(V, V, V, V).noalias() -= (a-v.sigma)/(1.0+a-v.sigma) * cached_vec * lattice_->eigenvectors.block(V, V, V, V).row(v.x);
 }
 
 template <> template <>
 inline void HubbardInteraction<true>::apply_vertex_on_the_left (const Vertex &v, HubbardInteraction<true>::MatrixType &M) {
-	double C = eigenvectors_.block(0, 0, V, V).row(v.x) * M.col(0).head(V);
-	M.col(0).head(V).noalias() += (a+v.sigma) * eigenvectors_.block(0, 0, V, V).row(v.x).transpose() * C;
-	double D = eigenvectors_.block(V, V, V, V).row(v.x) * M.col(1).tail(V);
-	M.col(1).tail(V).noalias() += (a-v.sigma) * eigenvectors_.block(V, V, V, V).row(v.x).transpose() * D;
+	double C = lattice_->eigenvectors.block(0, 0, V, V).row(v.x) * M.col(0).head(V);
+	M.col(0).head(V).noalias() += (a+v.sigma) * lattice_->eigenvectors.block(0, 0, V, V).row(v.x).transpose() * C;
+	double D = lattice_->eigenvectors.block(V, V, V, V).row(v.x) * M.col(1).tail(V);
+	M.col(1).tail(V).noalias() += (a-v.sigma) * lattice_->eigenvectors.block(V, V, V, V).row(v.x).transpose() * D;
 }
 
 template <> template <>
 inline void HubbardInteraction<true>::apply_inverse_on_the_left (const Vertex &v, HubbardInteraction<true>::MatrixType &M) {
-	double C = eigenvectors_.block(0, 0, V, V).row(v.x) * M.col(0).head(V);
-	M.col(0).head(V).noalias() -= (a+v.sigma)/(1.0+a+v.sigma) * eigenvectors_.block(0, 0, V, V).row(v.x).transpose() * C;
-	double D = eigenvectors_.block(V, V, V, V).row(v.x) * M.col(1).tail(V);
-	M.col(1).tail(V).noalias() -= (a-v.sigma)/(1.0+a-v.sigma) * eigenvectors_.block(V, V, V, V).row(v.x).transpose() * D;
+	double C = lattice_->eigenvectors.block(0, 0, V, V).row(v.x) * M.col(0).head(V);
+	M.col(0).head(V).noalias() -= (a+v.sigma)/(1.0+a+v.sigma) * lattice_->eigenvectors.block(0, 0, V, V).row(v.x).transpose() * C;
+	double D = lattice_->eigenvectors.block(V, V, V, V).row(v.x) * M.col(1).tail(V);
+	M.col(1).tail(V).noalias() -= (a-v.sigma)/(1.0+a-v.sigma) * lattice_->eigenvectors.block(V, V, V, V).row(v.x).transpose() * D;
 }
 
 template <> template <>
@@ -9,6 +9,7 @@
 
 #include "accumulator.hpp"
 #include "hubbard.hpp"
+#include "philox.hpp"
 
 
 #include <cstdlib>
@@ -765,7 +766,7 @@ class V3Probability {
 
 class V3Updater {
 	private:
-	std::mt19937_64 generator;
+	Philox generator;
 	std::bernoulli_distribution coin_flip;
 	std::uniform_int_distribution<size_t> randomPosition;
 	std::uniform_int_distribution<size_t> randomSlice;
@@ -1126,7 +1127,7 @@ class V3Measurements {
 typedef std::chrono::duration<double> seconds_type;
 
 int main (int argc, char **argv) {
-	std::mt19937_64 generator;
+	Philox generator;
 	CubicLattice lattice;
 	lattice.set_size(4, 4, 1);
 	lattice.compute();
@@ -4,6 +4,7 @@
 #include "configuration.hpp"
 #include "slice.hpp"
 #include "hubbard.hpp"
+#include "philox.hpp"
 
 #include <random>
 
@@ -15,12 +16,13 @@ class LCTSimulation {
 		left_to_right = 1
 	} sweep_direction_type;
 
+	typedef HubbardInteraction<true> Interaction;
+
 	private:
 
-	std::mt19937_64 generator;
+	Philox generator;
 	std::uniform_real_distribution<double> d;
 	std::exponential_distribution<double> trial;
-	typedef HubbardInteraction<true> Interaction;
 	Configuration<Interaction> conf;
 	double p1; // probability at the start of the simulation (absolute value)
 	double pr; // probability ration of the current configuration wrt p1 (absolute values)
@@ -28,37 +30,95 @@ class LCTSimulation {
 
 	sweep_direction_type sweep_direction_;
 	size_t updates_;
+	size_t order_; // vertices, counted by the updates
 
 	public:
 
 	LCTSimulation (Parameters params, size_t seed_offset=0) :
-		generator(params.getInteger("SEED",42)+seed_offset),
+		generator(params.getInteger("SEED",42), seed_offset),
 		conf(params),
 		sweep_direction_(right_to_left),
-		updates_(0) {
+		updates_(0),
+		order_(0) {
+			init(params);
+		}
+
+	// one of several chains sharing the lattice data of model. Every chain
+	// draws from stream number chain of SEED, so chain 0 is a single run and
+	// any chain can be replayed on its own
+	LCTSimulation (Parameters params, const Interaction &model, size_t chain) :
+		generator(params.getInteger("SEED",42), chain),
+		conf(params, model),
+		sweep_direction_(right_to_left),
+		updates_(0),
+		order_(0) {
+			init(params);
+		}
+
+	// a chain as above that starts from the vertices of parent instead of
+	// random ones, with a single restart()
+	LCTSimulation (Parameters params, const Interaction &model, size_t chain, const LCTSimulation &parent) :
+		generator(params.getInteger("SEED",42), chain),
+		conf(params, model),
+		sweep_direction_(right_to_left),
+		updates_(0),
+		order_(0) {
 			conf.setup(params);
-			for (size_t i=0;i<conf.slice_number();i++) {
-				conf.set_index(i);
-				for (size_t j=0;j<2*conf.volume();j++) {
-					conf.insert(conf.generate_vertex(generator));
-				}
-				//std::cerr << i << " -> " << conf.slice_size() << std::endl;
+			warm_start(parent);
+		}
+
+	void init (const Parameters &params) {
+		conf.setup(params);
+		for (size_t i=0;i<conf.slice_number();i++) {
+			conf.set_index(i);
+			for (size_t j=0;j<2*conf.volume();j++) {
+				conf.insert(conf.generate_vertex(generator));
 			}
-			conf.set_index(0);
-			conf.compute_right_side(0);
-			conf.start();
-			conf.start();
-			conf.compute_B();
-			p1 = 0.0, ps = 0.0, pr = 0.0;
-			std::tie(p1, ps) = conf.probability();
-			conf.set_index(0);
-			conf.compute_propagators_2_right();
+			//std::cerr << i << " -> " << conf.slice_size() << std::endl;
 		}
+		restart();
+	}
+
+	// recomputes all decompositions and the weight of the current
+	// configuration from scratch, and starts a new sweep
+	void restart () {
+		set_direction_right_to_left();
+		conf.set_index(0);
+		conf.compute_right_side(0);
+		conf.start();
+		conf.start();
+		conf.compute_B();
+		p1 = 0.0, ps = 0.0, pr = 0.0;
+		std::tie(p1, ps) = conf.probability();
+		conf.set_index(0);
+		conf.compute_propagators_2_right();
+		order_ = conf.vertices();
+	}
+
+	// evaluates the current vertices at a different U (same K): the weight
+	// changes through the determinant only, see probability()
+	void set_interaction_strength (double U) {
+		conf.set_interaction_strength(U);
+		restart();
+	}
+
+	double interaction_strength () const { return conf.interaction_strength(); }
+
+	// continues from the vertices of a simulation at nearby parameters,
+	// stretched in imaginary time if beta differs
+	void warm_start (const LCTSimulation &other) {
+		conf.set_vertices(other.conf.vertex_list(), other.conf.inverse_temperature());
+		restart();
+	}
 
 	void update_left (bool check = false) {
+		PHASE_TIMER(proposal);
 		Interaction::Vertex v;
 		double dp = 0.0, s = 1.0;
-		if (d(generator)<0.5) {
+		const double r = d(generator);
+		if (r<0.5 && conf.slice_size()==0) {
+			// nothing to remove: rejected
+		} else if (r<0.5) {
 			v = conf.get_vertex(d(generator)*conf.slice_size());
 			dp = conf.remove_probability(v);
 			s = dp>0.0?1.0:-1.0;
@@ -66,6 +126,7 @@ class LCTSimulation {
 			if (-trial(generator)<dp+conf.remove_factor()) {
 				//cerr << "removed vertex " << v.tau << endl;
 				conf.remove_and_update(v);
+				order_--;
 				pr += dp;
 				ps *= s;
 			} else {
@@ -79,6 +140,7 @@ class LCTSimulation {
 			if (-trial(generator)<dp+conf.insert_factor()) {
 				//cerr << "inserted vertex " << v.tau << endl;
 				conf.insert_and_update(v);
+				order_++;
 				pr += dp;
 				ps *= s;
 			} else {
@@ -95,9 +157,13 @@ class LCTSimulation {
 	}
 
 	void update_right (bool check = false) {
+		PHASE_TIMER(proposal);
 		Interaction::Vertex v;
 		double dp = 0.0, s = 1.0;
-		if (d(generator)<0.5) {
+		const double r = d(generator);
+		if (r<0.5 && conf.slice_size()==0) {
+			// nothing to remove: rejected
+		} else if (r<0.5) {
 			v = conf.get_vertex(d(generator)*conf.slice_size());
 			dp = conf.remove_probability_right(v);
 			s = dp>0.0?1.0:-1.0;
@@ -105,6 +171,7 @@ class LCTSimulation {
 			if (-trial(generator)<dp+conf.remove_factor()) {
 				//cerr << "removed vertex " << v.tau << endl;
 				conf.remove_and_update_right(v);
+				order_--;
 				pr += dp;
 				ps *= s;
 			} else {
@@ -118,6 +185,7 @@ class LCTSimulation {
 			if (-trial(generator)<dp+conf.insert_factor()) {
 				//cerr << "inserted vertex " << v.tau << endl;
 				conf.insert_and_update_right(v);
+				order_++;
 				pr += dp;
 				ps *= s;
 			} else {
@@ -209,6 +277,14 @@ class LCTSimulation {
 	double probability_difference () const { return pr; }
 
 	size_t vertices () const { return conf.vertices(); }
+
+	// Expansion order in O(1). The vertices expand the operator
+	//   sum_x K - U (n_x,up n_x,dn - (n_x,up + n_x,dn)/2)
+	// over the I interacting sites, so that <k> = beta <...> and
+	//   U sum_x <n_x,up n_x,dn - (n_x,up + n_x,dn)/2> = K I - <k>/beta
+	size_t order () const { return order_; }
+	double order_shift () const { return interaction().expansion_constant()*interaction().interacting_sites(); }
+	double inverse_temperature () const { return conf.inverse_temperature(); }
 	const Eigen::MatrixXd & green_function () const {
 		return conf.green_function();
 	}
@@ -226,6 +302,7 @@ class LCTSimulation {
 	void response_function (Eigen::ArrayXXd &gf) const { return conf.gf_tau(gf); }
 
 	size_t volume () const { return conf.volume(); }
+	const Interaction &interaction () const { return conf.interaction(); }
 	size_t full_sweep_size () const { return 2*conf.slice_number(); }
 
 	sweep_direction_type sweep_direction () const { return sweep_direction_; }
@@ -0,0 +1,71 @@
+#ifndef LOCAL_OBSERVABLES_HPP
+#define LOCAL_OBSERVABLES_HPP
+
+#include <Eigen/Dense>
+
+// Local real-space quantities from an equal-time Green function G given in
+// the eigenbasis of the hopping, as returned by LCTSimulation: the real-space
+// matrix is U G U^t, with U the eigenvectors of the interaction (spin up
+// orbitals first), and is never formed. U and G are block diagonal in spin,
+// and so is W = U G, which set() computes with one n x n product per spin
+// block; any real-space element is then the dot product of a row of W with
+// an eigenvector row within their block, (U G U^t)_ij = W_i. U_j., in O(n),
+// and zero across blocks, so only the elements that are asked for are ever
+// computed.
+//
+// The diagonal is taken as the densities, as in interaction_energy().
+template <typename Interaction>
+class LocalObservables {
+	const Interaction *I_;
+	Eigen::MatrixXd W_;
+	size_t V_;
+
+	public:
+	LocalObservables () : I_(nullptr), V_(0) {}
+
+	void set (const Interaction &I, const Eigen::MatrixXd &G) {
+		const Eigen::MatrixXd &E = I.eigenvectors();
+		I_ = &I;
+		V_ = I.volume();
+		// only the diagonal blocks of W are used
+		W_.resize(G.rows(), G.cols());
+		for (size_t b=0;b<I.blocks();b++) {
+			const size_t s = I.block_start(b), n = I.block_size(b);
+			W_.block(s, s, n, n).noalias() = E.block(s, s, n, n)*G.block(s, s, n, n);
+		}
+	}
+
+	// real-space element (i, j) of G, for spin orbitals i and j
+	double element (size_t i, size_t j) const {
+		for (size_t b=0;b<I_->blocks();b++) {
+			const size_t s = I_->block_start(b), n = I_->block_size(b);
+			const bool has_i = i>=s && i<s+n, has_j = j>=s && j<s+n;
+			if (has_i && has_j) return W_.row(i).segment(s, n).dot(I_->eigenvectors().row(j).segment(s, n));
+			if (has_i || has_j) return 0.0;
+		}
+		return 0.0;
+	}
+
+	double density (size_t x) const { return element(x, x) + element(x+V_, x+V_); }
+	double magnetization (size_t x) const { return 0.5*(element(x, x) - element(x+V_, x+V_)); }
+	double double_occupancy (size_t x) const { return element(x, x) * element(x+V_, x+V_); }
+
+	// <c^+_x c_y + c^+_y c_x> summed over spin
+	double hopping (size_t x, size_t y) const {
+		return element(x, y) + element(y, x) + element(x+V_, y+V_) + element(y+V_, x+V_);
+	}
+
+	// <S^z_x S^z_y> for x!=y by Wick's theorem, as in Simulation::measure_quick
+	double spin_correlation (size_t x, size_t y) const {
+		const double ux = element(x, x), uy = element(y, y);
+		const double dx = element(x+V_, x+V_), dy = element(y+V_, y+V_);
+		double ret = ux*uy + dx*dy - ux*dy - dx*uy;
+		ret -= element(x, y)*element(y, x) + element(x+V_, y+V_)*element(y+V_, x+V_);
+		return 0.25*ret;
+	}
+
+	size_t volume () const { return V_; }
+};
+
+#endif // LOCAL_OBSERVABLES_HPP
+
@@ -10,12 +10,18 @@
 #include <mutex>
 #include <atomic>
 #include <functional>
+#include <memory>
+#include <map>
+#include <sstream>
+#include <cmath>
 
 #include "helpers.hpp"
 #include "measurements.hpp"
 #include "weighted_measurements.hpp"
 #include "logger.hpp"
 #include "svd.hpp"
+#include "writer.hpp"
+#include "equilibration.hpp"
 
 extern "C" {
 #include <fftw3.h>
@@ -58,58 +64,189 @@ void signal_handler (int signum) {
 }
 
 
-void run_thread (int j, lua_State *L, Logger &log, std::mutex &lock, std::atomic<int> &current, std::atomic<int> &failed) {
-	signal(SIGINT, signal_handler);
-	steady_clock::time_point t0 = steady_clock::now();
-	steady_clock::time_point t1 = steady_clock::now();
-	steady_clock::time_point t2 = steady_clock::now();
-	log << "thread" << j << "starting";
-	while (true) {
-		steady_clock::time_point t_start = steady_clock::now();
-		int job = current.fetch_add(1);
-		lock.lock();
+struct Job {
+	int index; // position in the job table
+	SimulationParameters parameters;
+	int thermalization;
+	int warm_thermalization; // used instead of thermalization after a warm start
+	bool auto_thermalization; // stop thermalizing when stationary, thermalization is then the cap
+	int sweeps; // a cap when target_errors is not empty
+	std::map<std::string, double> target_errors; // stop when all relative errors are below these
+	double wall_time; // seconds, including thermalization; 0 for no limit
+	std::string savefile;
+	bool binary_checkpoint; // write savefile in binary format instead of Lua
+	double checkpoint_interval; // seconds between periodic checkpoints
+	bool resume;
+	SimulationCheckpoint checkpoint;
+};
+
+// Two preallocated snapshots per simulation: the chain fills one while the
+// writer thread may still be saving the other, so a checkpoint costs a copy
+// of the state and never waits for the disk.
+struct CheckpointBuffers {
+	SimulationCheckpoint snapshots[2];
+	std::atomic<bool> busy[2];
+	int next;
+	CheckpointBuffers () : next(0) { busy[0] = busy[1] = false; }
+};
+
+// reads all jobs from the table at the top of the stack
+std::vector<Job> parse_jobs (lua_State *L, Logger &log) {
+	std::vector<Job> jobs;
+	for (int job=1;;job++) {
 		lua_rawgeti(L, -1, job);
 		if (lua_isnil(L, -1)) {
-			log << "thread" << j << "terminating";
 			lua_pop(L, 1);
-			lock.unlock();
 			break;
 		}
-		log << "thread" << j << "running simulation" << job;
-		lua_getfield(L, -1, "THERMALIZATION"); int thermalization_sweeps = lua_tointeger(L, -1); lua_pop(L, 1);
-		lua_getfield(L, -1, "SWEEPS"); int total_sweeps = lua_tointeger(L, -1); lua_pop(L, 1);
-		lua_getfield(L, -1, "savefile"); std::string savefile = lua_isstring(L, -1)?lua_tostring(L, -1):std::string(); lua_pop(L, 1);
-		Simulation simulation(L, -1);
+		Job j;
+		j.index = job;
+		j.parameters.load(L, -1);
+		// every job draws its own stream of SEED, so that jobs with the same
+		// SEED, or none, are independent whichever thread runs them
+		j.parameters.stream = job;
+		if (!j.parameters.has_seed && !j.parameters.seed_state.empty()) {
+			Philox g;
+			std::stringstream in(j.parameters.seed_state);
+			if (!(in >> g)) log << "job" << job << "ignoring SEED: not a Philox state, using stream" << job << "of seed 0";
+		}
+		lua_getfield(L, -1, "THERMALIZATION"); j.thermalization = lua_tointeger(L, -1); lua_pop(L, 1);
+		lua_getfield(L, -1, "SWEEPS"); j.sweeps = lua_tointeger(L, -1); lua_pop(L, 1);
+		lua_getfield(L, -1, "AUTO_THERMALIZATION"); j.auto_thermalization = lua_toboolean(L, -1); lua_pop(L, 1);
+		lua_getfield(L, -1, "TARGET_ERRORS");
+		if (lua_istable(L, -1)) {
+			lua_pushnil(L);
+			while (lua_next(L, -2)) {
+				if (lua_type(L, -2)==LUA_TSTRING && lua_isnumber(L, -1)) j.target_errors[lua_tostring(L, -2)] = lua_tonumber(L, -1);
+				lua_pop(L, 1);
+			}
+		}
+		lua_pop(L, 1);
+		lua_getfield(L, -1, "WALL_TIME"); j.wall_time = lua_isnumber(L, -1)?lua_tonumber(L, -1):0.0; lua_pop(L, 1);
+		lua_getfield(L, -1, "WARM_THERMALIZATION"); j.warm_thermalization = lua_isnumber(L, -1)?lua_tointeger(L, -1):j.thermalization/4; lua_pop(L, 1);
+		lua_getfield(L, -1, "savefile"); j.savefile = lua_isstring(L, -1)?lua_tostring(L, -1):std::string(); lua_pop(L, 1);
+		lua_getfield(L, -1, "checkpoint_format"); j.binary_checkpoint = !lua_isstring(L, -1) || std::string(lua_tostring(L, -1))!="lua"; lua_pop(L, 1);
+		lua_getfield(L, -1, "checkpoint_interval"); j.checkpoint_interval = lua_isnumber(L, -1)?lua_tonumber(L, -1):600.0; lua_pop(L, 1);
+		lua_getfield(L, -1, "checkpoint_mmap"); bool use_mmap = lua_isnil(L, -1) || lua_toboolean(L, -1); lua_pop(L, 1);
 		lua_pop(L, 1);
-		if (!savefile.empty()) {
-			if (luaL_dofile(L, savefile.c_str())) {
+		j.resume = false;
+		if (!j.savefile.empty() && SimulationCheckpoint::is_binary(j.savefile)) {
+			steady_clock::time_point t0 = steady_clock::now();
+			if (j.checkpoint.read(j.savefile, use_mmap)) {
+				j.thermalization = j.checkpoint.thermalization;
+				j.sweeps = j.checkpoint.sweeps;
+				j.resume = true;
+				log << "restored binary checkpoint" << j.savefile << "in" << duration_cast<seconds_type>(steady_clock::now()-t0).count() << "seconds";
+			} else {
+				log << "error loading savefile:" << j.savefile << "is corrupted";
+			}
+		} else if (!j.savefile.empty()) {
+			steady_clock::time_point t0 = steady_clock::now();
+			if (luaL_dofile(L, j.savefile.c_str())) {
 				log << "error loading savefile:" << lua_tostring(L, -1);
 				lua_pop(L, 1);
+			} else if (!j.checkpoint.load(L)) {
+				lua_pop(L, 1);
+				log << "error loading savefile:" << j.savefile << "holds a generator state older than Philox; starting job" << job << "afresh";
 			} else {
-				lua_getfield(L, -1, "THERMALIZATION"); thermalization_sweeps = lua_tointeger(L, -1); lua_pop(L, 1);
-				lua_getfield(L, -1, "SWEEPS"); total_sweeps = lua_tointeger(L, -1); lua_pop(L, 1);
-				simulation.load_checkpoint(L);
+				j.thermalization = j.checkpoint.thermalization;
+				j.sweeps = j.checkpoint.sweeps;
+				j.resume = true;
 				lua_pop(L, 1);
+				log << "restored Lua checkpoint" << j.savefile << "in" << duration_cast<seconds_type>(steady_clock::now()-t0).count() << "seconds";
 			}
+		}
+		jobs.push_back(j);
+	}
+	return jobs;
+}
+
+// Jobs are normally handed out one at a time. In a warm started scan
+// (WARM_START = true) the job table is a path in parameter space: every
+// thread runs a contiguous stretch of it in order and starts each job from
+// the final field of the previous one, with WARM_THERMALIZATION sweeps.
+void run_thread (int j, int nthreads, bool warm, const std::vector<Job> &jobs, LuaWriter &writer, Logger &log, std::atomic<int> &current, std::atomic<int> &failed) {
+	signal(SIGINT, signal_handler);
+	steady_clock::time_point t0 = steady_clock::now();
+	steady_clock::time_point t1 = steady_clock::now();
+	steady_clock::time_point t2 = steady_clock::now();
+	log << "thread" << j << "starting";
+	const size_t first = jobs.size()*j/nthreads;
+	const size_t last = jobs.size()*(j+1)/nthreads;
+	size_t position = first;
+	SimulationCheckpoint previous; // final state of the last job of this thread
+	int previous_job = -1;
+	while (true) {
+		steady_clock::time_point t_start = steady_clock::now();
+		size_t next = warm?position++:current.fetch_add(1);
+		if (next>=(warm?last:jobs.size())) {
+			log << "thread" << j << "terminating";
+			break;
+		}
+		const Job &current_job = jobs[next];
+		int job = current_job.index;
+		log << "thread" << j << "running simulation" << job;
+		int thermalization_sweeps = current_job.thermalization;
+		int total_sweeps = current_job.sweeps;
+		std::string savefile = current_job.savefile;
+		std::shared_ptr<Simulation> simulation_ptr;
+		try {
+			simulation_ptr = std::make_shared<Simulation>(current_job.parameters);
+		} catch (...) {
+			failed++;
+			log << "thread" << j << "could not set up simulation" << job;
+			continue;
+		}
+		Simulation &simulation = *simulation_ptr;
+		if (current_job.resume) {
+			simulation.restore(current_job.checkpoint);
 			if (thermalization_sweeps>0) simulation.discard_measurements();
+		} else if (warm && previous_job>=0) {
+			simulation.warm_start(previous);
+			thermalization_sweeps = current_job.warm_thermalization;
+			log << "thread" << j << "warm start of simulation" << job << "from simulation" << previous_job;
 		}
 		//simulation.load_sigma(L, "nice.lua");
-		lock.unlock();
+		std::shared_ptr<CheckpointBuffers> buffers = std::make_shared<CheckpointBuffers>();
 		auto save_checkpoint = [&] (int thermalization, int sweeps) {
-			lock.lock();
-			simulation.save_checkpoint(L);
-			lua_pushinteger(L, thermalization);
-			lua_setfield(L, -2, "THERMALIZATION");
-			lua_pushinteger(L, sweeps);
-			lua_setfield(L, -2, "SWEEPS");
-			lua_pushstring(L, getenv("LSB_JOBID"));
-			lua_setfield(L, -2, "JOBID");
-			lua_getglobal(L, "serialize");
-			lua_insert(L, -2);
-			lua_pushstring(L, savefile.c_str());
-			lua_insert(L, -2);
-			lua_pcall(L, 2, 0, 0);
-			lock.unlock();
+			if (savefile.empty()) return;
+			int k = buffers->next;
+			if (buffers->busy[k]) {
+				log << "thread" << j << "skipping checkpoint: writer still busy";
+				return;
+			}
+			steady_clock::time_point t0 = steady_clock::now();
+			SimulationCheckpoint &c = buffers->snapshots[k];
+			simulation.checkpoint(c);
+			c.thermalization = thermalization;
+			c.sweeps = sweeps;
+			double snapshot_time = duration_cast<seconds_type>(steady_clock::now()-t0).count();
+			buffers->busy[k] = true;
+			buffers->next = 1-k;
+			bool binary = current_job.binary_checkpoint;
+			writer.push([buffers, k, binary, snapshot_time, savefile, &log] (lua_State *L) {
+				const SimulationCheckpoint &c = buffers->snapshots[k];
+				steady_clock::time_point t0 = steady_clock::now();
+				bool ok = true;
+				if (binary) {
+					ok = c.write(savefile);
+				} else {
+					c.save(L);
+					lua_pushstring(L, getenv("LSB_JOBID"));
+					lua_setfield(L, -2, "JOBID");
+					lua_getglobal(L, "serialize");
+					lua_insert(L, -2);
+					lua_pushstring(L, savefile.c_str());
+					lua_insert(L, -2);
+					lua_pcall(L, 2, 0, 0);
+				}
+				buffers->busy[k] = false;
+				if (ok) {
+					log << "checkpoint" << savefile << "written in" << duration_cast<seconds_type>(steady_clock::now()-t0).count() << "seconds (snapshot took" << snapshot_time << "seconds)";
+				} else {
+					log << "error writing checkpoint" << savefile;
+				}
+			});
 		};
 		auto save_density = [&] (const char *n) {
 			int N = simulation.timeSlices();
@@ -124,13 +261,17 @@ void run_thread (int j, lua_State *L, Logger &log, std::mutex &lock, std::atomic
 			}
 		};
 		save_checkpoint(thermalization_sweeps, total_sweeps);
+		EquilibrationDetector detector(thermalization_sweeps/10);
+		const int sign_series = detector.add_observable("sign");
+		const int density_series = detector.add_observable("density");
 		try {
 			t0 = steady_clock::now();
 			t1 = steady_clock::now();
 			for (int i=0;i<thermalization_sweeps;i++) {
-				if (duration_cast<seconds_type>(steady_clock::now()-t2).count()>5 && !savefile.empty() && signaled>0) {
+				double since_checkpoint = duration_cast<seconds_type>(steady_clock::now()-t2).count();
+				if (!savefile.empty() && ((since_checkpoint>5 && signaled>0) || since_checkpoint>current_job.checkpoint_interval)) {
+					if (signaled>0) log << "saving checkpoint";
 					signaled = 0;
-					log << "saving checkpoint";
 					t2 = steady_clock::now();
 					save_checkpoint(thermalization_sweeps-i, total_sweeps);
 				}
@@ -139,6 +280,7 @@ void run_thread (int j, lua_State *L, Logger &log, std::mutex &lock, std::atomic
 					int N = simulation.timeSlices();
 					int V = simulation.volume();
 					log << "thread" << j << "thermalizing: " << i << '/' << thermalization_sweeps << "..." << (double(simulation.steps)/duration_cast<seconds_type>(t1-t0).count()) << "steps per second (" << N*V << "sites sweep in" << (duration_cast<seconds_type>(t1-t0).count()*N*V/simulation.steps) << "seconds)";
+					timers::report_every(log, 60.0);
 					log << simulation.measured_sign;
 					log << "Density: " << measurement_ratio(simulation.density, simulation.measured_sign, " +- ");
 					log << "Magnetization: " << measurement_ratio(simulation.magnetization, simulation.measured_sign, " +- ") << '\n';
@@ -146,19 +288,49 @@ void run_thread (int j, lua_State *L, Logger &log, std::mutex &lock, std::atomic
 				}
 				simulation.update();
 				simulation.measure_quick();
+				if (current_job.auto_thermalization) {
+					detector.add(sign_series, simulation.current_sign());
+					detector.add(density_series, simulation.current_density());
+					if (detector.check()) {
+						log << "thread" << j << "stationary after" << i+1 << '/' << thermalization_sweeps << "thermalization sweeps:" << detector.status();
+						break;
+					}
+				}
+			}
+			if (current_job.auto_thermalization && !detector.equilibrated()) {
+				log << "thread" << j << "not stationary at the thermalization cap:" << detector.status();
 			}
 			log << "thread" << j << "thermalized";
 			simulation.steps = 0;
 			simulation.discard_measurements();
 			t0 = steady_clock::now();
+			std::map<std::string, double> targets;
+			for (const auto &t : current_job.target_errors) {
+				if (std::isnan(simulation.relative_error(t.first))) log << "thread" << j << "ignoring target error for unknown observable" << t.first;
+				else targets.insert(t);
+			}
 			for (int i=0;i<total_sweeps;i++) {
-				if (duration_cast<seconds_type>(steady_clock::now()-t2).count()>600 && !savefile.empty()) {
+				if (i%16==0 && (!targets.empty() || current_job.wall_time>0.0)) {
+					double elapsed = duration_cast<seconds_type>(steady_clock::now()-t_start).count();
+					if (current_job.wall_time>0.0 && elapsed>current_job.wall_time) {
+						log << "thread" << j << "wall time exhausted after" << i << '/' << total_sweeps << "sweeps";
+						break;
+					}
+					bool met = !targets.empty();
+					for (const auto &t : targets) met = met && simulation.relative_error(t.first)<t.second;
+					if (met) {
+						log << "thread" << j << "error targets met after" << i << '/' << total_sweeps << "sweeps";
+						break;
+					}
+				}
+				if (duration_cast<seconds_type>(steady_clock::now()-t2).count()>current_job.checkpoint_interval && !savefile.empty()) {
 					t2 = steady_clock::now();
 					save_checkpoint(0, total_sweeps-i);
 				}
 				if (duration_cast<seconds_type>(steady_clock::now()-t1).count()>5) {
 					t1 = steady_clock::now();
 					log << "thread" << j << "running: " << i << '/' << total_sweeps << "..." << (double(simulation.steps)/duration_cast<seconds_type>(t1-t0).count()) << "steps per second";
+					timers::report_every(log, 60.0);
 					//save_density("density.dat");
 				}
 				simulation.update();
@@ -167,19 +339,23 @@ void run_thread (int j, lua_State *L, Logger &log, std::mutex &lock, std::atomic
 			}
 			double seconds = duration_cast<seconds_type>(steady_clock::now()-t_start).count();
 			log << "thread" << j << "finished simulation" << job << "in" << seconds << "seconds";
-			lock.lock();
-			simulation.output_results();
-			lua_rawgeti(L, -1, job);
-			lua_pushnumber(L, seconds);
-			lua_setfield(L, -2, "elapsed_time");
-			simulation.save(L, lua_gettop(L));
-			lua_getglobal(L, "serialize");
-			lua_insert(L, -2);
-			lua_getfield(L, -1, "outfile");
-			lua_insert(L, -2);
-			lua_pcall(L, 2, 0, 0);
+			if (warm) {
+				simulation.checkpoint(previous);
+				previous_job = job;
+			}
+			writer.push([simulation_ptr, job, seconds] (lua_State *L) {
+				simulation_ptr->output_results();
+				lua_rawgeti(L, -1, job);
+				lua_pushnumber(L, seconds);
+				lua_setfield(L, -2, "elapsed_time");
+				simulation_ptr->save(L, lua_gettop(L));
+				lua_getglobal(L, "serialize");
+				lua_insert(L, -2);
+				lua_getfield(L, -1, "outfile");
+				lua_insert(L, -2);
+				lua_pcall(L, 2, 0, 0);
+			});
 			//save_density("density.dat");
-			lock.unlock();
 		} catch (...) {
 			failed++;
 			log << "thread" << j << "caught exception in simulation" << job << " with params " << simulation.params();
@@ -208,21 +384,33 @@ int main (int argc, char **argv) {
 		nthreads = lua_tointeger(L, -1);
 	}
 	lua_pop(L, 1);
+	lua_getfield(L, -1, "WARM_START");
+	bool warm = lua_toboolean(L, -1);
+	lua_pop(L, 1);
 	Logger log(cout);
 	//log.setVerbosity(5);
 	log << "using" << nthreads << "threads";
 
+	std::vector<Job> jobs = parse_jobs(L, log);
+	log << "parsed" << jobs.size() << "jobs";
+
+	// from here on the Lua state is only used by the writer thread
+	LuaWriter writer(L);
+	writer.start();
+
 	std::vector<std::thread> threads(nthreads);
-	std::mutex lock;
 	std::atomic<int> failed;
 	failed = 0;
 	std::atomic<int> current;
-	current = 1;
+	current = 0;
 	for (int j=0;j<nthreads;j++) {
-		threads[j] = std::thread(run_thread, j, L, std::ref(log), std::ref(lock), std::ref(current), std::ref(failed));
+		threads[j] = std::thread(run_thread, j, nthreads, warm, std::cref(jobs), std::ref(writer), std::ref(log), std::ref(current), std::ref(failed));
 	}
 	for (std::thread& t : threads) t.join();
 	log << "joined threads";
+	timers::report(log);
+	writer.finish();
+	log << "results written";
 	lua_getglobal(L, "serialize");
 	lua_insert(L, -2);
 	lua_pushstring(L, "stablefast_out.lua");
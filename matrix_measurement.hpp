@@ -0,0 +1,166 @@
+#ifndef MATRIX_MEASUREMENT_HPP
+#define MATRIX_MEASUREMENT_HPP
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <limits>
+
+#include <Eigen/Dense>
+
+// Binning accumulator for array-valued observables (e.g. Green's functions).
+// Unlike measurement<Eigen::ArrayXXd> the number of levels is fixed and all
+// storage is allocated on the first sample; every add() then works in place.
+// Level i holds blocks of 2^i samples, the last level absorbs everything above.
+// Since bins() cannot exceed levels, the default error() matches the one of
+// measurement<Eigen::ArrayXXd> only below 2^levels samples.
+//
+// If an error level is set, sums and squares are only kept for that level
+// (plus the sum of level 0 for the mean), which cuts the memory to about
+// levels+3 arrays instead of 3*levels. That level has no error before
+// 2^(level+1) samples, and error() is then NaN: see has_error().
+class matrix_measurement {
+	public:
+		typedef Eigen::ArrayXXd array_type;
+	private:
+		std::vector<array_type> sums_;
+		std::vector<array_type> squared_sums_;
+		std::vector<array_type> x_;
+		std::vector<long> n_;
+		std::string name_;
+		int levels_;
+		int error_level_; // -1: keep all levels
+		int rows_, cols_;
+
+		bool keeps_sum (int i) const { return error_level_<0 || i==0 || i==error_level_; }
+		bool keeps_square (int i) const { return error_level_<0 || i==error_level_; }
+
+		void allocate (int rows, int cols) {
+			rows_ = rows;
+			cols_ = cols;
+			sums_.resize(levels_);
+			squared_sums_.resize(levels_);
+			x_.resize(levels_);
+			n_.assign(levels_, 0);
+			for (int i=0;i<levels_;i++) {
+				if (keeps_sum(i)) sums_[i].setZero(rows, cols);
+				if (keeps_square(i)) squared_sums_[i].setZero(rows, cols);
+				x_[i].setZero(rows, cols);
+			}
+		}
+
+		// propagates the block average stored in x_[i-1] from level i upwards
+		void carry (int i) {
+			for (;i<levels_;i++) {
+				const array_type &y = x_[i-1];
+				if (keeps_sum(i)) sums_[i] += y;
+				if (keeps_square(i)) squared_sums_[i] += y.square();
+				n_[i]++;
+				if (n_[i]%2==1) {
+					x_[i] = y;
+					break;
+				} else {
+					x_[i] += y;
+					x_[i] *= 0.5;
+				}
+			}
+		}
+
+	public:
+		matrix_measurement (const char *n = "Result", int levels = 16, int error_level = -1)
+			: name_(n), levels_(std::max(levels, 1)), error_level_(error_level<levels?error_level:levels-1), rows_(0), cols_(0) {}
+
+		const std::string &name () const { return name_; }
+		void set_name (const std::string &name) { name_ = name; }
+
+		// discards all data
+		void set_levels (int levels, int error_level = -1) {
+			levels_ = std::max(levels, 1);
+			error_level_ = error_level<levels_?error_level:levels_-1;
+			clear();
+		}
+
+		int levels () const { return levels_; }
+		int error_level () const { return error_level_; }
+
+		void clear () {
+			sums_.clear();
+			squared_sums_.clear();
+			x_.clear();
+			n_.clear();
+			rows_ = cols_ = 0;
+		}
+
+		// adds s*x
+		template <typename Derived>
+		void add (double s, const Eigen::ArrayBase<Derived> &x) {
+			if (n_.empty() || rows_!=x.rows() || cols_!=x.cols()) allocate(x.rows(), x.cols());
+			if (keeps_sum(0)) sums_[0] += s*x;
+			if (keeps_square(0)) squared_sums_[0] += (s*s)*x.square();
+			n_[0]++;
+			if (n_[0]%2==1) {
+				x_[0] = s*x;
+			} else {
+				x_[0] += s*x;
+				x_[0] *= 0.5;
+				carry(1);
+			}
+		}
+
+		template <typename Derived>
+		void add (const Eigen::ArrayBase<Derived> &x) { add(1.0, x); }
+
+		template <typename Derived>
+		void add (const Eigen::MatrixBase<Derived> &x) { add(1.0, x.array()); }
+
+		template <typename Derived>
+		void add (double s, const Eigen::MatrixBase<Derived> &x) { add(s, x.array()); }
+
+		// pools the levels of an independent run with the same shape and
+		// levels, as measurement<T>::merge
+		void merge (const matrix_measurement &other) {
+			if (other.n_.empty()) return;
+			if (n_.empty()) allocate(other.rows_, other.cols_);
+			for (int i=0;i<levels_;i++) {
+				if (keeps_sum(i)) sums_[i] += other.sums_[i];
+				if (keeps_square(i)) squared_sums_[i] += other.squared_sums_[i];
+				if (n_[i]==0) x_[i] = other.x_[i];
+				n_[i] += other.n_[i];
+			}
+		}
+
+		// number of levels that received at least one sample
+		size_t bins () const { return std::count_if(n_.begin(), n_.end(), [] (long n) { return n>0; }); }
+		long samples (int i = 0) const { return n_.empty()?0:n_[i]; }
+		bool has_level (int i) const { return i>=0 && i<levels_ && keeps_square(i); }
+
+		void mean (array_type &m, int i = 0) const {
+			if (samples(i)==0 || !keeps_sum(i)) m.setZero(rows_, cols_);
+			else m = sums_[i] / double(n_[i]);
+		}
+
+		array_type mean (int i = 0) const { array_type m; mean(m, i); return m; }
+
+		array_type variance (int i = 0) const {
+			if (samples(i)==0 || !keeps_square(i)) return array_type::Zero(rows_, cols_);
+			return squared_sums_[i]/double(n_[i]) - (sums_[i]/double(n_[i])).square();
+		}
+
+		array_type error (int i) const {
+			if (samples(i)==0 || !keeps_square(i)) return array_type::Zero(rows_, cols_);
+			return (variance(i)/double(n_[i])).sqrt();
+		}
+
+		// false while the error level has fewer than two blocks
+		bool has_error () const { return error_level_<0 || samples(error_level_)>=2; }
+
+		// error estimate from the error level, or six levels below the top as in measurement<T>
+		array_type error () const {
+			if (!has_error()) return array_type::Constant(rows_, cols_, std::numeric_limits<double>::quiet_NaN());
+			if (error_level_>=0) return error(error_level_);
+			return error(std::max(int(bins())-6, 0));
+		}
+};
+
+#endif // MATRIX_MEASUREMENT_HPP
+
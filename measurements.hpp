@@ -68,6 +68,26 @@ class measurement {
 
 		void repeat () { add(x_[0]); }
 
+		// pools the bins of an independent run (e.g. another Markov chain):
+		// every bin of level i is a block of 2^i samples from one run, so the
+		// pooled sums give the mean and error bars of the combined data.
+		// Pending half-filled blocks of other are not carried over.
+		void merge (const measurement &other) {
+			if (other.bins()>bins()) set_bins(other.bins());
+			for (size_t i=0;i<other.bins();i++) {
+				if (other.n_[i]==0) continue;
+				if (n_[i]==0) {
+					sums_[i] = other.sums_[i];
+					squared_sums_[i] = other.squared_sums_[i];
+					x_[i] = other.x_[i];
+				} else {
+					sums_[i] += other.sums_[i];
+					squared_sums_[i] += other.squared_sums_[i];
+				}
+				n_[i] += other.n_[i];
+			}
+		}
+
 		T last_value (int i = 0) const { return x_[i]; }
 		T sum (int i = 0) const { return sums_[i]; }
 		T mean (int i = 0) const { if (bins()>0) return sums_[i] / double(n_[i]); else return T(); }
@@ -90,6 +110,12 @@ class measurement {
 			return error(std::max(size_t(0), bins()-6));
 		}
 
+		// the binning errors at the level used by error() have levelled off
+		bool converged () const {
+			int N = std::max(int(bins())-6, int(0));
+			return N>=2 && 2*error(N-1)>=(error(N)+error(N-2));
+		}
+
 		size_t bins() const { return n_.size(); }
 		int samples (int i = 0) const { if (n_.size()==0) return 0; else return n_[i]; }
 
@@ -116,7 +142,7 @@ template <typename T, bool Log> std::ostream& operator<< (std::ostream& out, con
 	} else {
 		int N = std::max(int(m.bins())-6, int(0));
 		out << m.name() << ": " << m.mean() << " +- " << m.error(N) << std::endl;
-		if (N<2 || 2*m.error(N-1)<(m.error(N)+m.error(N-2))) {
+		if (!m.converged()) {
 			out << "NOT CONVERGING" << std::endl;
 		}
 		out << "Bins: " << m.bins() << std::endl;
@@ -1,28 +1,50 @@
 #include "mpfr.hpp"
+#include "threadpool.hpp"
 
 #include <Eigen/LU>
 
 using namespace std;
 
-PreciseMatrix::PreciseMatrix (mpfr_prec_t precision) : rows_(0), cols_(0), data_(NULL), prec_(precision), rnd_(MPFR_RNDN) {}
+// columns of a product handled by one task: each coefficient of the left
+// factor is loaded once per block instead of once per column
+static const size_t column_block = 4;
+
+PreciseMatrix::PreciseMatrix (mpfr_prec_t precision) : rows_(0), cols_(0), data_(NULL), limbs_(NULL), prec_(precision), rnd_(MPFR_RNDN), pool_(NULL) {}
+
+void PreciseMatrix::parallel (size_t n, const std::function<void (int, int)> &f) const {
+	if (pool_!=NULL) {
+		pool_->parallel_for(n, f);
+	} else {
+		for (size_t i=0;i<n;i++) f(i, 0);
+	}
+}
 PreciseMatrix::~PreciseMatrix () { cleanup(); }
 
+// the coefficients do not own their significands: no mpfr_clear
 void PreciseMatrix::cleanup () {
-	const size_t V = size();
-	for (size_t i=0;i<V;i++) {
-		mpfr_clear(data_[i]);
-	}
 	if (data_!=NULL) delete[] data_;
+	if (limbs_!=NULL) delete[] limbs_;
 	data_ = NULL;
+	limbs_ = NULL;
+}
+
+void PreciseMatrix::set_precision (mpfr_prec_t precision) {
+	if (precision==prec_) return;
+	cleanup();
+	rows_ = cols_ = 0;
+	prec_ = precision;
 }
 
 void PreciseMatrix::resize (size_t newrows, size_t newcols) {
 	if (size()!=newrows*newcols) {
 		cleanup();
 		const size_t V = newrows*newcols;
+		const size_t n = (mpfr_custom_get_size(prec_)+sizeof(mp_limb_t)-1)/sizeof(mp_limb_t);
 		data_ = new mpfr_t[V];
+		limbs_ = new mp_limb_t[V*n];
 		for (size_t i=0;i<V;i++) {
-			mpfr_init2(data_[i], prec_);
+			mpfr_custom_init(limbs_+i*n, prec_);
+			mpfr_custom_init_set(data_[i], MPFR_ZERO_KIND, 0, prec_, limbs_+i*n);
 		}
 	}
 	rows_ = newrows;
@@ -68,75 +90,103 @@ const PreciseMatrix& PreciseMatrix::operator+= (const Eigen::MatrixXd& B) {
 void PreciseMatrix::applyOnTheRight (const Eigen::MatrixXd& B) {
 	PreciseMatrix C(prec_);
 	C = Eigen::MatrixXd::Zero(rows(), B.cols());
-	mpfr_t c;
-	mpfr_init2(c, prec_);
-	for (size_t i=0;i<rows();i++){
+	const size_t blocks = (B.cols()+column_block-1)/column_block;
+	parallel(blocks, [&] (int b, int) {
+		mpfr_t c;
+		mpfr_init2(c, prec_);
+		const size_t k0 = b*column_block, k1 = std::min(k0+column_block, size_t(B.cols()));
 		for (size_t j=0;j<cols();j++) {
-			for (size_t k=0;k<size_t(B.cols());k++) {
-				// C(i, k) += A(i, j)*B(j, k)
-				mpfr_mul_d(c, coeff(i, j), B(j, k), rnd());
-				mpfr_add(C.coeff(i, k), C.coeff(i, k), c, rnd());
+			for (size_t k=k0;k<k1;k++) {
+				if (B(j, k)==0.0) continue;
+				for (size_t i=0;i<rows();i++) {
+					// C(i, k) += A(i, j)*B(j, k)
+					mpfr_mul_d(c, coeff(i, j), B(j, k), rnd());
+					mpfr_add(C.coeff(i, k), C.coeff(i, k), c, rnd());
+				}
 			}
 		}
-	}
-	mpfr_clear(c);
+		mpfr_clear(c);
+	});
 	swap(C);
 }
 
 void PreciseMatrix::applyOnTheRight (const PreciseMatrix& B) {
 	PreciseMatrix C(prec_);
 	C = Eigen::MatrixXd::Zero(rows(), B.cols());
-	mpfr_t c;
-	mpfr_init2(c, prec_);
-	for (size_t i=0;i<rows();i++){
+	const size_t blocks = (B.cols()+column_block-1)/column_block;
+	parallel(blocks, [&] (int b, int) {
+		mpfr_t c;
+		mpfr_init2(c, prec_);
+		const size_t k0 = b*column_block, k1 = std::min(k0+column_block, B.cols());
 		for (size_t j=0;j<cols();j++) {
-			for (size_t k=0;k<B.cols();k++) {
-				// C(i, k) += A(i, j)*B(j, k)
-				mpfr_mul(c, B.coeff(j, k), coeff(i, j), rnd());
-				mpfr_add(C.coeff(i, k), C.coeff(i, k), c, rnd());
+			for (size_t k=k0;k<k1;k++) {
+				if (mpfr_zero_p(B.coeff(j, k))) continue;
+				for (size_t i=0;i<rows();i++) {
+					// C(i, k) += A(i, j)*B(j, k)
+					mpfr_mul(c, B.coeff(j, k), coeff(i, j), rnd());
+					mpfr_add(C.coeff(i, k), C.coeff(i, k), c, rnd());
+				}
 			}
 		}
-	}
-	mpfr_clear(c);
+		mpfr_clear(c);
+	});
 	swap(C);
 }
 
 void PreciseMatrix::applyOnTheLeft (const Eigen::MatrixXd& B) {
 	PreciseMatrix C(prec_);
 	C = Eigen::MatrixXd::Zero(B.rows(), cols());
-	mpfr_t c;
-	mpfr_init2(c, prec_);
-	for (int i=0;i<B.rows();i++){
+	const size_t blocks = (cols()+column_block-1)/column_block;
+	parallel(blocks, [&] (int b, int) {
+		mpfr_t c;
+		mpfr_init2(c, prec_);
+		const size_t k0 = b*column_block, k1 = std::min(k0+column_block, cols());
 		for (size_t j=0;j<rows();j++) {
-			for (size_t k=0;k<cols();k++) {
-				// C(i, k) += B(i, j)*A(j, k)
-				mpfr_mul_d(c, coeff(j, k), B(i, j), rnd());
-				mpfr_add(C.coeff(i, k), C.coeff(i, k), c, rnd());
+			for (size_t k=k0;k<k1;k++) {
+				if (mpfr_zero_p(coeff(j, k))) continue;
+				for (size_t i=0;i<size_t(B.rows());i++) {
+					// C(i, k) += B(i, j)*A(j, k)
+					mpfr_mul_d(c, coeff(j, k), B(i, j), rnd());
+					mpfr_add(C.coeff(i, k), C.coeff(i, k), c, rnd());
+				}
 			}
 		}
-	}
-	mpfr_clear(c);
+		mpfr_clear(c);
+	});
 	swap(C);
 }
 
 void PreciseMatrix::applyOnTheLeft (const PreciseMatrix& B) {
 	PreciseMatrix C(prec_);
 	C = Eigen::MatrixXd::Zero(B.rows(), cols());
-	mpfr_t c;
-	mpfr_init2(c, prec_);
-	for (size_t i=0;i<B.rows();i++){
+	const size_t blocks = (cols()+column_block-1)/column_block;
+	parallel(blocks, [&] (int b, int) {
+		mpfr_t c;
+		mpfr_init2(c, prec_);
+		const size_t k0 = b*column_block, k1 = std::min(k0+column_block, cols());
 		for (size_t j=0;j<rows();j++) {
-			for (size_t k=0;k<cols();k++) {
-				// C(i, k) += B(i, j)*A(j, k)
-				mpfr_mul(c, coeff(j, k), B.coeff(i, j), rnd());
-				mpfr_add(C.coeff(i, k), C.coeff(i, k), c, rnd());
+			for (size_t k=k0;k<k1;k++) {
+				if (mpfr_zero_p(coeff(j, k))) continue;
+				for (size_t i=0;i<B.rows();i++) {
+					// C(i, k) += B(i, j)*A(j, k)
+					mpfr_mul(c, coeff(j, k), B.coeff(i, j), rnd());
+					mpfr_add(C.coeff(i, k), C.coeff(i, k), c, rnd());
+				}
 			}
 		}
-	}
-	mpfr_clear(c);
+		mpfr_clear(c);
+	});
 	swap(C);
 }
 
+void PreciseMatrix::scale_rows (const Eigen::VectorXd& d) {
+	parallel(cols(), [&] (int k, int) {
+		for (size_t i=0;i<rows();i++) {
+			mpfr_mul_d(coeff(i, k), coeff(i, k), d[i], rnd());
+		}
+	});
+}
+
 PreciseMatrix operator* (const Eigen::MatrixXd& A, const PreciseMatrix& B) {
 	PreciseMatrix C(B.precision());
 	C = Eigen::MatrixXd::Zero(A.rows(), B.cols());
@@ -201,6 +251,7 @@ void PreciseMatrix::swap (PreciseMatrix& other) {
 	std::swap(cols_, other.cols_);
 	std::swap(rnd_, other.rnd_);
 	std::swap(data_, other.data_);
+	std::swap(limbs_, other.limbs_);
 }
 
 int PreciseMatrix::permute_rows (const std::vector<int> &perm) {
@@ -253,81 +304,67 @@ void PreciseMatrix::apply_inverse_LU_vector (PreciseMatrix& v, const std::vector
 	mpfr_clears(sum, temp, (mpfr_ptr) 0);
 }
 
+// LU decomposition with implicitly scaled partial pivoting (same pivots as
+// Crout's method in NR ludcmp), in right-looking order so that the update
+// of the trailing submatrix can be split by columns.
 int PreciseMatrix::in_place_LU (std::vector<int> &perm) {
 	const int N = rows();
 	int d = 1;
-	int i,imax,j,k;
-	mpfr_t big, dum, sum, temp;
-	mpfr_inits2(prec_, big, dum, sum, temp, (mpfr_ptr) 0);
+	int i, imax = 0, j;
+	mpfr_t big, dum;
+	mpfr_inits2(prec_, big, dum, (mpfr_ptr) 0);
 	PreciseMatrix vv; //   vv stores the implicit scaling of each row.
 	vv = Eigen::VectorXd::Zero(N);
 	perm.resize(N);
-	for (i=1;i<=N;i++) { // Loop over rows to get the implicit scaling information.
+	for (i=0;i<N;i++) { // Loop over rows to get the implicit scaling information.
 		mpfr_set_zero(big, +1);
-		for (j=1;j<=N;j++)
-			if (mpfr_cmpabs(coeff(i-1, j-1), big)>0) mpfr_set(big, coeff(i-1, j-1), rnd_);
+		for (j=0;j<N;j++)
+			if (mpfr_cmpabs(coeff(i, j), big)>0) mpfr_set(big, coeff(i, j), rnd_);
 		//No nonzero largest element.
-		if (mpfr_zero_p(big)) throw("Singular matrix in routine ludcmp");
+		if (mpfr_zero_p(big)) {
+			mpfr_clears(big, dum, (mpfr_ptr) 0);
+			throw("Singular matrix in routine ludcmp");
+		}
 		//Save the scaling.
-		mpfr_d_div(vv.coeff(i-1, 0), 1.0, big, rnd_);
-		mpfr_abs(vv.coeff(i-1, 0), vv.coeff(i-1, 0), rnd_);
+		mpfr_d_div(vv.coeff(i, 0), 1.0, big, rnd_);
+		mpfr_abs(vv.coeff(i, 0), vv.coeff(i, 0), rnd_);
 	}
-	for (j=1;j<=N;j++) { // This is the loop over columns of Crout’s method.
-		for (i=1;i<j;i++) {
-			//This is equation (2.3.12) except for i = j.
-			mpfr_set(sum, coeff(i-1, j-1), rnd_);
-			for (k=1;k<i;k++) {
-				//sum -= a[i][k]*a[k][j];
-				mpfr_mul(temp, coeff(i-1, k-1), coeff(k-1, j-1), rnd_);
-				mpfr_sub(sum, sum, temp, rnd_);
-			}
-			mpfr_set(coeff(i-1, j-1), sum, rnd_);
-		}
-		//Initialize for the search for largest pivot element.
+	for (j=0;j<N;j++) {
+		// column j is fully updated: search for the largest scaled pivot
 		mpfr_set_zero(big, +1);
-		for (i=j;i<=N;i++) {
-			//This is i = j of equation (2.3.12) and i = j + 1 . . . N
-			mpfr_set(sum, coeff(i-1, j-1), rnd_);
-			//of equation (2.3.13).
-			for (k=1;k<j;k++) {
-				//sum -= a[i][k]*a[k][j];
-				mpfr_mul(temp, coeff(i-1, k-1), coeff(k-1, j-1), rnd_);
-				mpfr_sub(sum, sum, temp, rnd_);
-			}
-			mpfr_set(coeff(i-1, j-1), sum, rnd_);
-			mpfr_mul(dum, vv.coeff(i-1, 0), sum, rnd_);
+		for (i=j;i<N;i++) {
+			mpfr_mul(dum, vv.coeff(i, 0), coeff(i, j), rnd_);
 			if (mpfr_cmpabs(dum, big)>=0) {
-				//Is the figure of merit for the pivot better than the best so far?
 				mpfr_abs(big, dum, rnd_);
-				imax=i;
+				imax = i;
 			}
 		}
-		//Do we need to interchange rows?
 		if (j!=imax) {
-			//Yes, do so...
-			for (k=1;k<=N;k++) {
-				mpfr_swap(coeff(imax-1, k-1), coeff(j-1, k-1));
+			for (int k=0;k<N;k++) {
+				mpfr_swap(coeff(imax, k), coeff(j, k));
 			}
-			//...and change the parity of d.
 			d = -d;
-			//Also interchange the scale factor.
-			mpfr_set(vv.coeff(imax-1, 0), vv.coeff(j-1, 0), rnd_);
-		}
-		perm[j-1]=imax-1;
-		//If the pivot element is zero the matrix is singular (at least to the precision of the
-		//algorithm). For some applications on singular matrices, it is desirable to substitute
-		//TINY for zero.
-		// if (a[j][j] == 0.0) a[j][j]=TINY;
-		if (j!=N) // Now, finally, divide by the pivot element.
-		{
-			mpfr_d_div(dum, 1.0, coeff(j-1, j-1), rnd_);
-			for (i=j+1;i<=N;i++) mpfr_mul(coeff(i-1, j-1), coeff(i-1, j-1), dum, rnd_);
+			mpfr_set(vv.coeff(imax, 0), vv.coeff(j, 0), rnd_);
 		}
+		perm[j] = imax;
+		if (j==N-1) break;
+		// divide by the pivot element...
+		mpfr_d_div(dum, 1.0, coeff(j, j), rnd_);
+		for (i=j+1;i<N;i++) mpfr_mul(coeff(i, j), coeff(i, j), dum, rnd_);
+		// ...and update the trailing submatrix: a[i][k] -= a[i][j]*a[j][k]
+		parallel(N-j-1, [&] (int c, int) {
+			const int k = j+1+c;
+			if (mpfr_zero_p(coeff(j, k))) return;
+			mpfr_t temp;
+			mpfr_init2(temp, prec_);
+			for (int i=j+1;i<N;i++) {
+				mpfr_mul(temp, coeff(i, j), coeff(j, k), rnd_);
+				mpfr_sub(coeff(i, k), coeff(i, k), temp, rnd_);
+			}
+			mpfr_clear(temp);
+		});
 	}
-	//Go back for the next column in the reduction.
-	mpfr_clears(big, dum, sum, temp, (mpfr_ptr) 0);
-	//vv.transpose_in_place();
-	//cout << vv << endl;
+	mpfr_clears(big, dum, (mpfr_ptr) 0);
 	return d;
 }
 
@@ -394,12 +431,16 @@ void PreciseMatrix::balance () {
 	mpfr_clears(s, r, g, f, c, sqrdx, (mpfr_ptr) 0);
 }
 
+// Elimination with the NR elmhes scheme. All the multipliers of a step
+// are computed first; as the elementary transformations of one step
+// commute, the row operations can then be done row by row and the column
+// operations on column m row by row as well, each split over the pool.
 void PreciseMatrix::reduce_to_hessenberg () {
 	bool pivoting = false;
 	const int n = rows();
 	int m, j, i;
-	mpfr_t y, x, z;
-	mpfr_inits2(prec_, y, x, z, (mpfr_ptr) 0);
+	mpfr_t x;
+	mpfr_init2(x, prec_);
 	for (m=2;m<n;m++) {
 		// m is called r + 1 in the text.
 		mpfr_set_zero(x, +1);
@@ -417,27 +458,39 @@ void PreciseMatrix::reduce_to_hessenberg () {
 			for (j=1;j<=n;j++) mpfr_swap(coeff(j-1, i-1), coeff(j-1, m-1));
 		}
 		if (!mpfr_zero_p(x)) {
-			// Carry out the elimination.
-			//cout << "carrying out the elimination on row " << m << endl;
+			// Carry out the elimination: the multipliers y_i replace a[i][m-1]
 			for (i=m+1;i<=n;i++) {
 				if (!mpfr_zero_p(coeff(i-1, m-2))) {
-					mpfr_div(y, coeff(i-1, m-2), x, rnd_);
-					mpfr_set(coeff(i-1, m-2), y, rnd_);
-					for (j=m;j<=n;j++) {
-						//a[i][j] -= y*a[m][j];
-						mpfr_mul(z, y, coeff(m-1, j-1), rnd_);
-						mpfr_sub(coeff(i-1, j-1), coeff(i-1, j-1), z, rnd_);
-					}
-					for (j=1;j<=n;j++) {
-						//a[j][m] += y*a[j][i];
-						mpfr_mul(z, y, coeff(j-1, i-1), rnd_);
-						mpfr_add(coeff(j-1, m-1), coeff(j-1, m-1), z, rnd_);
-					}
+					mpfr_div(coeff(i-1, m-2), coeff(i-1, m-2), x, rnd_);
 				}
 			}
+			// a[i][j] -= y_i*a[m][j]
+			parallel(n-m, [&] (int r, int) {
+				const int i = m+1+r;
+				if (mpfr_zero_p(coeff(i-1, m-2))) return;
+				mpfr_t z;
+				mpfr_init2(z, prec_);
+				for (int j=m;j<=n;j++) {
+					mpfr_mul(z, coeff(i-1, m-2), coeff(m-1, j-1), rnd_);
+					mpfr_sub(coeff(i-1, j-1), coeff(i-1, j-1), z, rnd_);
+				}
+				mpfr_clear(z);
+			});
+			// a[j][m] += sum_i y_i*a[j][i]
+			parallel(n, [&] (int r, int) {
+				const int j = r+1;
+				mpfr_t z;
+				mpfr_init2(z, prec_);
+				for (int i=m+1;i<=n;i++) {
+					if (mpfr_zero_p(coeff(i-1, m-2))) continue;
+					mpfr_mul(z, coeff(i-1, m-2), coeff(j-1, i-1), rnd_);
+					mpfr_add(coeff(j-1, m-1), coeff(j-1, m-1), z, rnd_);
+				}
+				mpfr_clear(z);
+			});
 		}
 	}
-	mpfr_clears(y, x, z, (mpfr_ptr) 0);
+	mpfr_clear(x);
 }
 
 void PreciseMatrix::extract_hessenberg_H (PreciseMatrix& other) {
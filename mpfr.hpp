@@ -10,15 +10,30 @@
 
 #include <algorithm>
 #include <utility>
+#include <vector>
+#include <functional>
 
+class ThreadPool;
+
+// Dense matrix of MPFR numbers, stored column major.
+// The significands of all coefficients live in one arena, in the same column
+// major order, initialized through MPFR's custom interface: resizing costs
+// one allocation instead of one per coefficient, and sweeps over a column
+// touch contiguous memory. Row and column swaps exchange significand
+// pointers inside the arena, so coefficients never point outside of it.
+// If a thread pool is set, products, LU and Hessenberg reductions split
+// their work over it (MPFR must be built thread safe, which is the default).
 class PreciseMatrix {
 	private:
 	size_t rows_;
 	size_t cols_;
 	mpfr_t *data_;
+	mp_limb_t *limbs_;
 	mpfr_prec_t prec_;
 	mpfr_rnd_t rnd_;
+	ThreadPool *pool_; // not owned
 	void cleanup ();
+	void parallel (size_t n, const std::function<void (int, int)> &f) const;
 	public:
 	PreciseMatrix (mpfr_prec_t precision = 64);
 	~PreciseMatrix ();
@@ -29,6 +44,9 @@ class PreciseMatrix {
 	mpfr_t* data () const { return data_; }
 	mpfr_rnd_t rnd () const { return rnd_; }
 	mpfr_prec_t precision () const { return prec_; }
+	ThreadPool *pool () const { return pool_; }
+	void set_pool (ThreadPool *pool) { pool_ = pool; }
+	void set_precision (mpfr_prec_t precision); // discards the contents
 	const mpfr_t& coeff (size_t row, size_t col) const { return data_[row+rows()*col]; }
 	mpfr_t& coeff (size_t row, size_t col) { return data_[row+rows()*col]; }
 	void set_coeff (size_t row, size_t col, double x) { mpfr_set_d(data_[row+rows()*col], x, rnd_); }
@@ -42,6 +60,7 @@ class PreciseMatrix {
 	void applyOnTheRight (const PreciseMatrix& B);
 	void applyOnTheLeft (const Eigen::MatrixXd& B);
 	void applyOnTheLeft (const PreciseMatrix& B);
+	void scale_rows (const Eigen::VectorXd& d); // applies diag(d) on the left
 	void swap (PreciseMatrix& other);
 	void extract_bands (PreciseMatrix& other, int n, int m);
 	int permute_rows (const std::vector<int>& perm);
@@ -0,0 +1,132 @@
+#ifndef PHILOX_HPP
+#define PHILOX_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <iostream>
+
+// Counter-based random number generator Philox4x32-10 (Salmon et al.,
+// "Parallel random numbers: as easy as 1, 2, 3", SC11). Block b of stream s
+// is a fixed bijection of the 128 bit counter (b, s) under the 64 bit key
+// (the seed), so the state is just (seed, stream, block, position): streams
+// are split by number instead of by seeding, any point of a stream can be
+// reached in constant time, and blocks can be generated in any order.
+//
+// Satisfies UniformRandomBitGenerator with 64 bit results, two per block.
+class Philox {
+	public:
+		typedef uint64_t result_type;
+
+	private:
+		uint64_t key_;
+		uint64_t stream_;
+		uint64_t counter_; // next block
+		unsigned index_; // position in buffer_, 2 when empty
+		uint64_t buffer_[2]; // block counter_-1
+
+		static void block (uint64_t key, uint64_t stream, uint64_t counter, uint64_t *out) {
+			uint32_t c0 = counter, c1 = counter>>32, c2 = stream, c3 = stream>>32;
+			uint32_t k0 = key, k1 = key>>32;
+			for (int r=0;r<10;r++) {
+				const uint64_t p0 = uint64_t(0xD2511F53)*c0;
+				const uint64_t p1 = uint64_t(0xCD9E8D57)*c2;
+				c0 = uint32_t(p1>>32)^c1^k0;
+				c1 = uint32_t(p1);
+				c2 = uint32_t(p0>>32)^c3^k1;
+				c3 = uint32_t(p0);
+				k0 += 0x9E3779B9;
+				k1 += 0xBB67AE85;
+			}
+			out[0] = (uint64_t(c1)<<32) | c0;
+			out[1] = (uint64_t(c3)<<32) | c2;
+		}
+
+	public:
+		static constexpr result_type min () { return 0; }
+		static constexpr result_type max () { return ~result_type(0); }
+
+		explicit Philox (uint64_t s = 0, uint64_t stream = 0) { seed(s, stream); }
+
+		void seed (uint64_t s, uint64_t stream = 0) {
+			key_ = s;
+			stream_ = stream;
+			counter_ = 0;
+			index_ = 2;
+		}
+
+		uint64_t get_seed () const { return key_; }
+		uint64_t get_stream () const { return stream_; }
+
+		// a fresh generator with the same seed and another stream number,
+		// e.g. one per chain or per thread
+		Philox split (uint64_t stream) const { return Philox(key_, stream); }
+
+		result_type operator() () {
+			if (index_==2) {
+				block(key_, stream_, counter_++, buffer_);
+				index_ = 0;
+			}
+			return buffer_[index_++];
+		}
+
+		void discard (unsigned long long n) {
+			while (n>0 && index_<2) {
+				index_++;
+				n--;
+			}
+			counter_ += n/2;
+			if (n%2) (*this)();
+		}
+
+		// n consecutive outputs of the stream; the blocks are independent,
+		// so the loop has no carried dependency and vectorizes
+		void generate (uint64_t *out, size_t n) {
+			while (n>0 && index_<2) {
+				*out++ = buffer_[index_++];
+				n--;
+			}
+			const size_t blocks = n/2;
+			for (size_t b=0;b<blocks;b++) block(key_, stream_, counter_+b, out+2*b);
+			counter_ += blocks;
+			if (n%2) out[n-1] = (*this)();
+		}
+
+		// n uniform doubles in [0, 1), with 53 random bits each
+		void generate_uniform (double *out, size_t n) {
+			uint64_t bits[64];
+			for (size_t i=0;i<n;i+=64) {
+				const size_t m = n-i<64?n-i:64;
+				generate(bits, m);
+				for (size_t j=0;j<m;j++) out[i+j] = (bits[j]>>11)*(1.0/9007199254740992.0);
+			}
+		}
+
+		bool operator== (const Philox &other) const {
+			return key_==other.key_ && stream_==other.stream_ && counter_==other.counter_ && index_==other.index_;
+		}
+		bool operator!= (const Philox &other) const { return !(*this==other); }
+
+		friend std::ostream &operator<< (std::ostream &out, const Philox &g) {
+			return out << g.key_ << ' ' << g.stream_ << ' ' << g.counter_ << ' ' << g.index_;
+		}
+
+		// leaves g untouched and sets failbit on malformed input
+		friend std::istream &operator>> (std::istream &in, Philox &g) {
+			uint64_t key, stream, counter;
+			unsigned index;
+			if (!(in >> key >> stream >> counter >> index)) return in;
+			if (index>2 || (index<2 && counter==0)) {
+				in.setstate(std::ios::failbit);
+				return in;
+			}
+			g.key_ = key;
+			g.stream_ = stream;
+			g.counter_ = counter;
+			g.index_ = index;
+			if (index<2) block(key, stream, counter-1, g.buffer_);
+			return in;
+		}
+};
+
+#endif // PHILOX_HPP
+
@@ -0,0 +1,94 @@
+#ifndef PIPELINE_HPP
+#define PIPELINE_HPP
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+// Single producer pipeline over a fixed pool of preallocated buffers.
+// The producer fills the buffer returned by acquire() and hands it over
+// with submit(); a worker thread calls process on the buffers in submission
+// order and returns them to the pool. The producer only waits in acquire()
+// when every buffer is in flight, and buffers keep their allocations
+// between uses.
+template <typename T>
+class Pipeline {
+	public:
+		typedef std::function<void (T &)> task_type;
+
+	private:
+		std::vector<T> buffers_;
+		task_type process_;
+		std::deque<size_t> free_;
+		std::deque<size_t> ready_;
+		size_t current_;
+		std::mutex mutex_;
+		std::condition_variable returned_;
+		std::condition_variable submitted_;
+		bool quit_;
+		std::thread thread_;
+
+		void run () {
+			std::unique_lock<std::mutex> lock(mutex_);
+			while (true) {
+				submitted_.wait(lock, [&] { return quit_ || !ready_.empty(); });
+				if (ready_.empty()) return;
+				size_t i = ready_.front();
+				ready_.pop_front();
+				lock.unlock();
+				process_(buffers_[i]);
+				lock.lock();
+				free_.push_back(i);
+				returned_.notify_all();
+			}
+		}
+
+	public:
+		Pipeline (size_t n, task_type process) : buffers_(n), process_(process), current_(0), quit_(false) {
+			for (size_t i=0;i<n;i++) free_.push_back(i);
+			thread_ = std::thread(&Pipeline::run, this);
+		}
+
+		Pipeline (const Pipeline&) = delete;
+		Pipeline& operator= (const Pipeline&) = delete;
+
+		// processes everything submitted so far
+		~Pipeline () {
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				quit_ = true;
+			}
+			submitted_.notify_one();
+			thread_.join();
+		}
+
+		T &acquire () {
+			std::unique_lock<std::mutex> lock(mutex_);
+			returned_.wait(lock, [&] { return !free_.empty(); });
+			current_ = free_.front();
+			free_.pop_front();
+			return buffers_[current_];
+		}
+
+		void submit () {
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				ready_.push_back(current_);
+			}
+			submitted_.notify_one();
+		}
+
+		// waits until every submitted buffer has been processed
+		void flush () {
+			std::unique_lock<std::mutex> lock(mutex_);
+			returned_.wait(lock, [&] { return free_.size()==buffers_.size(); });
+		}
+
+		size_t size () const { return buffers_.size(); }
+};
+
+#endif // PIPELINE_HPP
+
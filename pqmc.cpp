@@ -10,8 +10,10 @@
 #include <functional>
 
 #include "measurements.hpp"
+#include "equilibration.hpp"
 #include "logger.hpp"
 #include "svd.hpp"
+#include "philox.hpp"
 
 #include <Eigen/Dense>
 #include <Eigen/Eigenvalues>
@@ -742,7 +744,7 @@ class V3Probability {
 
 class V3Updater {
 	private:
-	std::mt19937_64 generator;
+	Philox generator;
 	std::bernoulli_distribution coin_flip;
 	std::uniform_int_distribution<size_t> randomPosition;
 	std::uniform_int_distribution<size_t> randomSlice;
@@ -1106,12 +1108,16 @@ int main (int argc, char **argv) {
 	steady_clock::time_point t0 = steady_clock::now();
 	signal(10, my_signal_handler);
 	signal(14, my_signal_handler);
+	// $SEED replays a run, otherwise the seed comes from /dev/urandom
 	unsigned int seed;
-	std::ifstream seedfile("/dev/urandom");
-	debug << "reading random seed";
-	seedfile.read(reinterpret_cast<char*>(&seed), sizeof(unsigned int));
-	debug << "read random seed";
-	seedfile.close();
+	if (getenv("SEED")) {
+		seed = strtoul(getenv("SEED"), NULL, 10);
+	} else {
+		std::ifstream seedfile("/dev/urandom");
+		seedfile.read(reinterpret_cast<char*>(&seed), sizeof(unsigned int));
+		seedfile.close();
+	}
+	debug << "random seed" << seed;
 
 	double beta = 5.0, mu = 0.5, U = 4.0, K = 5.0;
 	string outfile = "data.out";
@@ -1182,7 +1188,7 @@ int main (int argc, char **argv) {
 
 	V3Measurements measurements;
 
-	const int thermalization = 1000000;
+	const int thermalization = 1000000; // cap, ends earlier once the expansion order is stationary
 	const int sweeps = 1000000;
 
 	t0 = steady_clock::now();
@@ -1204,8 +1210,15 @@ int main (int argc, char **argv) {
 		//configuration.setBeta(std::min(configuration.inverseTemperature()+0.5, beta));
 	//}
 	updater.setup(configuration, prob);
+	EquilibrationDetector detector(thermalization/1000);
+	detector.add_observable("vertices");
 	for (int n=0;n<thermalization;n++) {
 		double a = updater.sweep(configuration, prob);
+		detector.add(0, configuration.verticesNumber());
+		if (detector.check()) {
+			cerr << "thermalized after " << n+1 << " sweeps: " << detector.status() << endl;
+			break;
+		}
 		//measurements.measure_ts(configuration, prob, updater);
 		if (signalled==10) {
 			signalled = 0;
@@ -13,6 +13,7 @@ extern "C" {
 }
 
 #include "akima.hpp"
+#include "green_function_io.hpp"
 
 #define PI atan2(0.0, -1.0)
 
@@ -57,6 +58,15 @@ void load_gf (lua_State *L, fftw_complex *G, int N, int Lx, int Ly) {
 	}
 }
 
+// G is stored [t][x][y] in the binary file, the same layout as the fftw arrays
+void load_gf (const double *data, fftw_complex *G, int N, int Lx, int Ly) {
+	int V = Lx*Ly;
+	for (int i=0;i<(N+1)*V*V;i++) {
+		G[i][0] = data[i];
+		G[i][1] = 0.0;
+	}
+}
+
 void transl_symm (fftw_complex* G, int N, int Lx, int Ly) {
 	int V = Lx*Ly;
 	for (int t=0;t<=N;t++) {
@@ -154,24 +164,37 @@ int main (int argc, char **argv) {
 	double beta;
 	ofstream out(argv[2]);
 	lua_State *L = luaL_newstate();
+	GreenFunctionFile gf;
+	bool binary = is_binary_green_function(argv[1]);
 
-	luaL_dofile(L, argv[1]);
+	if (binary) {
+		if (!gf.open(argv[1])) {
+			cerr << "Error loading binary Green's function \"" << argv[1] << '"' << endl;
+			return -1;
+		}
+		N = gf.header().N;
+		Lx = gf.header().Lx;
+		Ly = gf.header().Ly;
+		beta = gf.header().beta;
+	} else {
+		luaL_dofile(L, argv[1]);
 
-	lua_getglobal(L, "N");
-	N = lua_tointeger(L, -1);
-	lua_pop(L, 1);
+		lua_getglobal(L, "N");
+		N = lua_tointeger(L, -1);
+		lua_pop(L, 1);
 
-	lua_getglobal(L, "Lx");
-	Lx = lua_tointeger(L, -1);
-	lua_pop(L, 1);
+		lua_getglobal(L, "Lx");
+		Lx = lua_tointeger(L, -1);
+		lua_pop(L, 1);
 
-	lua_getglobal(L, "Ly");
-	Ly = lua_tointeger(L, -1);
-	lua_pop(L, 1);
+		lua_getglobal(L, "Ly");
+		Ly = lua_tointeger(L, -1);
+		lua_pop(L, 1);
 
-	lua_getglobal(L, "beta");
-	beta = lua_tonumber(L, -1);
-	lua_pop(L, 1);
+		lua_getglobal(L, "beta");
+		beta = lua_tonumber(L, -1);
+		lua_pop(L, 1);
+	}
 
 	int V = Lx*Ly;
 
@@ -183,13 +206,18 @@ int main (int argc, char **argv) {
 	fftw_plan g_up_plan = fftw_plan_many_dft(4, size, N+1, G_up_position, NULL, 1, V*V, G_up_momentum, NULL, 1, V*V, FFTW_FORWARD, FFTW_PATIENT);
 	fftw_plan g_dn_plan = fftw_plan_many_dft(4, size, N+1, G_dn_position, NULL, 1, V*V, G_dn_momentum, NULL, 1, V*V, FFTW_FORWARD, FFTW_PATIENT);
 
-	lua_getglobal(L, "G_up");
-	load_gf(L, G_up_position, N, Lx, Ly);
-	lua_pop(L, 1);
+	if (binary) {
+		load_gf(gf.G_up(), G_up_position, N, Lx, Ly);
+		load_gf(gf.G_dn(), G_dn_position, N, Lx, Ly);
+	} else {
+		lua_getglobal(L, "G_up");
+		load_gf(L, G_up_position, N, Lx, Ly);
+		lua_pop(L, 1);
 
-	lua_getglobal(L, "G_dn");
-	load_gf(L, G_dn_position, N, Lx, Ly);
-	lua_pop(L, 1);
+		lua_getglobal(L, "G_dn");
+		load_gf(L, G_dn_position, N, Lx, Ly);
+		lua_pop(L, 1);
+	}
 
 	transl_symm(G_up_position, N, Lx, Ly);
 	symm(G_up_position, N, Lx, Ly);
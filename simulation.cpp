@@ -1,7 +1,25 @@
 #include "simulation.hpp"
 #include "mpfr.hpp"
+#include "threadpool.hpp"
+#include "doubledouble.hpp"
 
 #include "lua_tuple.hpp"
+#include "binary_io.hpp"
+#include "green_function_io.hpp"
+
+#include <mutex>
+#include <limits>
+
+// the FFTW planner is not thread safe: plans are created and destroyed
+// under this lock, while fftw_execute* may be called concurrently.
+static std::mutex fftw_planner_mutex;
+
+Simulation::~Simulation () {
+	std::lock_guard<std::mutex> lock(fftw_planner_mutex);
+	fftw_destroy_plan(x2p_col);
+	fftw_destroy_plan(p2x_col);
+	correlations.destroy();
+}
 
 // FIXME only works in 2D
 void Simulation::prepare_open_boundaries () {
@@ -12,12 +30,14 @@ void Simulation::prepare_fft () {
 	if (Lz<2) E=2;
 	if (Lz<2 && Ly<2) E=1;
 	const int size[] = { Lx, Ly, Lz, };
+	std::lock_guard<std::mutex> lock(fftw_planner_mutex);
 	x2p_col = fftw_plan_many_dft_r2c(E, size, V, positionSpace.data(),
 			size, 1, V, reinterpret_cast<fftw_complex*>(momentumSpace.data()), size, 1, V, FFTW_PATIENT);
 	p2x_col = fftw_plan_many_dft_c2r(E, size, V, reinterpret_cast<fftw_complex*>(momentumSpace.data()),
 			size, 1, V, positionSpace.data(), size, 1, V, FFTW_PATIENT);
 	positionSpace.setIdentity(V, V);
 	momentumSpace.setZero(V, V);
+	correlations.setup(Lx, Ly, Lz);
 }
 
 
@@ -91,19 +111,15 @@ void Simulation::init () {
 	if (Lz<2) { Lz = 1; tz = 0.0; }
 	V = Lx * Ly * Lz;
 	time_shift = 0;
+	drift = 0.0;
 	if (flips_per_update<1) flips_per_update = V;
 	randomPosition = std::uniform_int_distribution<int>(0, V-1);
 	randomTime = std::uniform_int_distribution<int>(0, N-1);
 	dt = beta/N;
 	A = sqrt(exp(g*dt)-1.0);
-	diagonals.insert(diagonals.begin(), N, Vector_d::Zero(V));
+	field.resize(N, V);
 	distribution = std::bernoulli_distribution(0.5);
-	for (size_t i=0;i<diagonals.size();i++) {
-		diagonals[i] = Array_d::Constant(V, distribution(generator)?A:-A);
-		for (int j=0;j<V;j++) {
-			diagonals[i][j] = distribution(generator)?A:-A;
-		}
-	}
+	field.randomize(generator);
 
 	positionSpace.setIdentity(V, V);
 	momentumSpace.setIdentity(V, V);
@@ -121,28 +137,18 @@ void Simulation::init () {
 	reset_updates();
 }
 
-void Simulation::load (lua_State *L, int index) {
+void SimulationParameters::load (lua_State *L, int index) {
 	lua_pushvalue(L, index);
 	lua_get(L, config);
 	lua_pop(L, 1);
-	//std::cerr << config << std::endl;
-	Lx = config.Lx;
-	Ly = config.Ly;
-	Lz = config.Lz;
-	N = config.N;
-	beta = config.beta;
-	tx = config.tx;
-	ty = config.ty;
-	tz = config.tz;
-	g = fabs(config.U);
-	mu = config.mu;
-	B = config.B;
 	lua_getfield(L, index, "SEED");
+	has_seed = false;
+	seed_state.clear();
 	if (lua_isnumber(L, -1)) {
-		generator.seed(lua_tointeger(L, -1));
+		has_seed = true;
+		seed = lua_tointeger(L, -1);
 	} else if (lua_isstring(L, -1)) {
-		std::stringstream in(std::string(lua_tostring(L, -1)));
-		in >> generator;
+		seed_state = lua_tostring(L, -1);
 	}
 	lua_pop(L, 1);
 	lua_getfield(L, index, "w_x");     w_x = lua_tonumber(L, -1);            lua_pop(L, 1);
@@ -151,16 +157,71 @@ void Simulation::load (lua_State *L, int index) {
 	//lua_getfield(L, index, "h");    staggered_field = lua_tonumber(L, -1);     lua_pop(L, 1);
 	lua_getfield(L, index, "RESET");  reset = lua_toboolean(L, -1);            lua_pop(L, 1);
 	//lua_getfield(L, index, "REWEIGHT");  reweight = lua_tointeger(L, -1);      lua_pop(L, 1);
-	lua_getfield(L, index, "OUTPUT");  outfn = lua_tostring(L, -1);            lua_pop(L, 1);
-	lua_getfield(L, index, "gf_file"); gf_name = lua_tostring(L, -1);            lua_pop(L, 1);
+	lua_getfield(L, index, "OUTPUT");  outfn = lua_isstring(L, -1)?lua_tostring(L, -1):"";            lua_pop(L, 1);
+	lua_getfield(L, index, "gf_file"); gf_name = lua_isstring(L, -1)?lua_tostring(L, -1):"";            lua_pop(L, 1);
+	lua_getfield(L, index, "gf_levels"); if (lua_isnumber(L, -1)) gf_levels = lua_tointeger(L, -1); lua_pop(L, 1);
+	lua_getfield(L, index, "gf_error_level"); if (lua_isnumber(L, -1)) gf_error_level = lua_tointeger(L, -1); lua_pop(L, 1);
+	lua_getfield(L, index, "gf_threads"); if (lua_isnumber(L, -1)) gf_threads = lua_tointeger(L, -1); lua_pop(L, 1);
+	lua_getfield(L, index, "recheck_threads"); if (lua_isnumber(L, -1)) recheck_threads = lua_tointeger(L, -1); lua_pop(L, 1);
+	lua_getfield(L, index, "recheck_precision"); if (lua_isnumber(L, -1)) recheck_precision = lua_tointeger(L, -1); lua_pop(L, 1);
+	lua_getfield(L, index, "recheck_max_precision"); if (lua_isnumber(L, -1)) recheck_max_precision = lua_tointeger(L, -1); lua_pop(L, 1);
+	lua_getfield(L, index, "recheck_backend"); recheck_dd = lua_isstring(L, -1) && std::string(lua_tostring(L, -1))=="dd"; lua_pop(L, 1);
+	lua_getfield(L, index, "gf_format"); gf_binary = !lua_isstring(L, -1) || std::string(lua_tostring(L, -1))!="lua"; lua_pop(L, 1);
 	lua_getfield(L, index, "SLICES");  mslices = lua_tointeger(L, -1);         lua_pop(L, 1);
 	lua_getfield(L, index, "SVD");     msvd = lua_tointeger(L, -1);            lua_pop(L, 1);
 	lua_getfield(L, index, "flips_per_update");     flips_per_update = lua_tointeger(L, -1);            lua_pop(L, 1);
 	lua_getfield(L, index, "use_fft");     use_fft = lua_toboolean(L, -1);            lua_pop(L, 1);
 	//lua_getfield(L, index, "LOGFILE");  logfile.open(lua_tostring(L, -1));     lua_pop(L, 1);
+}
+
+void Simulation::load (const SimulationParameters &p) {
+	config = p.config;
+	//std::cerr << config << std::endl;
+	Lx = config.Lx;
+	Ly = config.Ly;
+	Lz = config.Lz;
+	N = config.N;
+	beta = config.beta;
+	tx = config.tx;
+	ty = config.ty;
+	tz = config.tz;
+	g = fabs(config.U);
+	mu = config.mu;
+	B = config.B;
+	generator.seed(p.has_seed?p.seed:0, p.stream);
+	if (!p.has_seed && !p.seed_state.empty()) {
+		// a state saved before the switch to Philox does not parse and
+		// leaves the stream above
+		std::stringstream in(p.seed_state);
+		in >> generator;
+	}
+	w_x = p.w_x;
+	w_y = p.w_y;
+	w_z = p.w_z;
+	reset = p.reset;
+	outfn = p.outfn;
+	gf_name = p.gf_name;
+	gf_binary = p.gf_binary;
+	gf_levels = p.gf_levels;
+	gf_error_level = p.gf_error_level;
+	gf_threads = p.gf_threads;
+	recheck_threads = p.recheck_threads;
+	recheck_precision = p.recheck_precision;
+	recheck_max_precision = p.recheck_max_precision;
+	recheck_dd = p.recheck_dd;
+	mslices = p.mslices;
+	msvd = p.msvd;
+	flips_per_update = p.flips_per_update;
+	use_fft = p.use_fft;
 	init();
 }
 
+void Simulation::load (lua_State *L, int index) {
+	SimulationParameters p;
+	p.load(L, index);
+	load(p);
+}
+
 void Simulation::save (lua_State *L, int index) {
 	if (index<1) index = lua_gettop(L)+index+1;
 	std::stringstream out;
@@ -209,74 +270,74 @@ void Simulation::save (lua_State *L, int index) {
 	lua_setfield(L, -2, "d_dn");
 	L << spincorrelation;
 	lua_setfield(L, -2, "spincorrelation");
+	L << spin_correlation_r;
+	lua_setfield(L, -2, "spin_correlation_r");
+	L << density_correlation_r;
+	lua_setfield(L, -2, "density_correlation_r");
+	L << structure_factor;
+	lua_setfield(L, -2, "structure_factor");
 	L << chi_d;
 	lua_setfield(L, -2, "chi_d");
 	lua_setfield(L, index, "results");
 }
 
-void Simulation::load_checkpoint (lua_State *L) {
+bool SimulationCheckpoint::load (lua_State *L) {
+	bool ret = true;
 	lua_getfield(L, -1, "SEED");
-	std::stringstream in;
-	in.str(lua_tostring(L, -1));
-	in >> generator;
+	if (lua_isstring(L, -1)) {
+		std::stringstream in;
+		in.str(lua_tostring(L, -1));
+		ret = bool(in >> generator);
+	}
 	lua_pop(L, 1);
 	lua_getfield(L, -1, "time_shift");
 	time_shift = lua_tointeger(L, -1);
 	lua_pop(L, 1);
+	results.clear();
 	lua_getfield(L, -1, "results");
-	lua_getfield(L, -1, "sign");
-	lua_get(L, sign);
-	lua_pop(L, 1);
-	lua_getfield(L, -1, "acceptance");
-	lua_get(L, acceptance);
-	lua_pop(L, 1);
-	lua_getfield(L, -1, "density");
-	lua_get(L, density);
-	lua_pop(L, 1);
-	lua_getfield(L, -1, "magnetization");
-	lua_get(L, magnetization);
-	lua_pop(L, 1);
-	lua_getfield(L, -1, "order_parameter");
-	lua_get(L, order_parameter);
-	lua_pop(L, 1);
-	lua_getfield(L, -1, "chi_af");
-	lua_get(L, chi_af);
+	if (lua_istable(L, -1)) {
+		lua_pushnil(L);
+		while (lua_next(L, -2)) {
+			if (lua_type(L, -2)==LUA_TSTRING && lua_istable(L, -1)) {
+				lua_get(L, results[lua_tostring(L, -2)]);
+			}
+			lua_pop(L, 1);
+		}
+	}
 	lua_pop(L, 1);
-	lua_getfield(L, -1, "exact_sign");
-	lua_get(L, exact_sign);
+	lua_getfield(L, -1, "N");
+	N = lua_tointeger(L, -1);
 	lua_pop(L, 1);
-	//lua_getfield(L, -1, "measured_sign");
-	//lua_get(L, measured_sign);
-	//lua_pop(L, 1);
-	//lua_getfield(L, -1, "sign_correlation");
-	//lua_get(L, sign_correlation);
-	//lua_pop(L, 1);
-	lua_getfield(L, -1, "chi_d");
-	lua_get(L, chi_d);
+	lua_getfield(L, -1, "V");
+	V = lua_tointeger(L, -1);
 	lua_pop(L, 1);
+	lua_getfield(L, -1, "Lx");
+	Lx = lua_tointeger(L, -1);
 	lua_pop(L, 1);
-	lua_getfield(L, -1, "N");
-	int oldN = lua_tointeger(L, -1);
+	lua_getfield(L, -1, "Ly");
+	Ly = lua_tointeger(L, -1);
 	lua_pop(L, 1);
-	lua_getfield(L, -1, "V");
-	int oldV = lua_tointeger(L, -1);
+	lua_getfield(L, -1, "Lz");
+	Lz = lua_tointeger(L, -1);
 	lua_pop(L, 1);
+	sigma.assign((size_t(N)*V+63)/64, 0);
 	lua_getfield(L, -1, "sigma");
-	for (int i=0;i<N;i++) {
-		int t = oldN<N?i%oldN:i;
-		for (int j=0;j<V;j++) {
-			int x = j%oldV;
-			lua_rawgeti(L, -1, t*oldV+x+1);
-			diagonals[t][x] = lua_tonumber(L, -1)<0.0?-A:A;
-			lua_pop(L, 1);
-			//std::cerr << (diagonals[t][x]<0.0?'-':'+') << ' ';
-		}
+	for (int i=0;i<N*V;i++) {
+		lua_rawgeti(L, -1, i+1);
+		if (lua_tonumber(L, -1)>0.0) sigma[i/64] |= uint64_t(1) << (i%64);
+		lua_pop(L, 1);
 	}
-	//std::cerr << std::endl;
 	lua_pop(L, 1);
+	lua_getfield(L, -1, "THERMALIZATION");
+	thermalization = lua_tointeger(L, -1);
+	lua_pop(L, 1);
+	lua_getfield(L, -1, "SWEEPS");
+	sweeps = lua_tointeger(L, -1);
+	lua_pop(L, 1);
+	return ret;
 }
 
-void Simulation::save_checkpoint (lua_State *L) {
+void SimulationCheckpoint::save (lua_State *L) const {
 	lua_newtable(L);
 	std::stringstream out;
 	out << generator;
@@ -285,44 +346,219 @@ void Simulation::save_checkpoint (lua_State *L) {
 	lua_pushinteger(L, time_shift);
 	lua_setfield(L, -2, "time_shift");
 	lua_newtable(L);
-	L << sign;
-	lua_setfield(L, -2, "sign");
-	L << acceptance;
-	lua_setfield(L, -2, "acceptance");
-	L << density;
-	lua_setfield(L, -2, "density");
-	L << magnetization;
-	lua_setfield(L, -2, "magnetization");
-	L << order_parameter;
-	lua_setfield(L, -2, "order_parameter");
-	L << chi_af;
-	lua_setfield(L, -2, "chi_af");
-	L << exact_sign;
-	lua_setfield(L, -2, "exact_sign");
-	//L << measured_sign;
-	//lua_setfield(L, -2, "measured_sign");
-	//L << sign_correlation;
-	//lua_setfield(L, -2, "sign_correlation");
-	L << chi_d;
-	lua_setfield(L, -2, "chi_d");
+	for (const auto &r : results) {
+		L << r.second;
+		lua_setfield(L, -2, r.first.c_str());
+	}
 	lua_setfield(L, -2, "results");
 	lua_pushinteger(L, N);
 	lua_setfield(L, -2, "N");
 	lua_pushinteger(L, V);
 	lua_setfield(L, -2, "V");
+	lua_pushinteger(L, Lx);
+	lua_setfield(L, -2, "Lx");
+	lua_pushinteger(L, Ly);
+	lua_setfield(L, -2, "Ly");
+	lua_pushinteger(L, Lz);
+	lua_setfield(L, -2, "Lz");
 	lua_newtable(L);
+	for (int i=0;i<N*V;i++) {
+		lua_pushnumber(L, up(i)?1.0:-1.0);
+		lua_rawseti(L, -2, i+1);
+	}
+	lua_setfield(L, -2, "sigma");
+	lua_pushinteger(L, thermalization);
+	lua_setfield(L, -2, "THERMALIZATION");
+	lua_pushinteger(L, sweeps);
+	lua_setfield(L, -2, "SWEEPS");
+}
+
+const char SimulationCheckpoint::magic[8] = { 'Q', 'M', 'C', 'C', 'K', 'P', 'T', '\0' };
+
+bool SimulationCheckpoint::is_binary (const std::string &fn) {
+	return binary_has_magic(fn, magic, sizeof(magic));
+}
+
+bool SimulationCheckpoint::write (const std::string &fn) const {
+	PHASE_TIMER(checkpoint_io);
+	BinaryOutput out;
+	out.reserve(1024 + N*V/8 + 64*results.size()*sizeof(double));
+	const uint32_t v = version;
+	out.write(magic, sizeof(magic));
+	out.write(v);
+	const int32_t header[] = { N, V, time_shift, thermalization, sweeps, Lx, Ly, Lz, };
+	out.write(header, 8);
+	// the generator is stored as the words of its textual representation
+	std::vector<uint64_t> state;
+	std::stringstream buf;
+	buf << generator;
+	uint64_t x;
+	while (buf >> x) state.push_back(x);
+	out.write<uint32_t>(state.size());
+	out.write(state.data(), state.size());
+	out.write(sigma.data(), sigma.size());
+	out.write<uint32_t>(results.size());
+	for (const auto &r : results) {
+		const mymeasurement<double> &m = r.second;
+		uint32_t b = m.bins();
+		out.write_string(r.first);
+		out.write_string(m.name());
+		out.write(b);
+		for (uint32_t i=0;i<b;i++) out.write<int32_t>(m.samples(i));
+		for (uint32_t i=0;i<b;i++) out.write(m.sum(i));
+		for (uint32_t i=0;i<b;i++) out.write(m.square(i));
+		for (uint32_t i=0;i<b;i++) out.write(m.last_value(i));
+	}
+	out.write_checksum();
+	return out.commit(fn);
+}
+
+bool SimulationCheckpoint::read (const std::string &fn, bool use_mmap) {
+	PHASE_TIMER(checkpoint_io);
+	BinaryInput in;
+	if (!in.open(fn, use_mmap)) return false;
+	if (!in.verify_checksum()) return false;
+	char m[sizeof(magic)];
+	uint32_t v = 0;
+	in.read(m, sizeof(m));
+	in.read(v);
+	if (!in.good() || std::memcmp(m, magic, sizeof(magic))!=0 || v<2 || v>version) return false;
+	int32_t header[8] = { 0, };
+	in.read(header, v<3?5:8);
+	N = header[0];
+	V = header[1];
+	time_shift = header[2];
+	thermalization = header[3];
+	sweeps = header[4];
+	Lx = header[5];
+	Ly = header[6];
+	Lz = header[7];
+	uint32_t n = 0;
+	in.read(n);
+	std::vector<uint64_t> state(n);
+	in.read(state.data(), n);
+	if (!in.good() || N<0 || V<0) return false;
+	std::stringstream buf;
+	for (uint64_t x : state) buf << x << ' ';
+	buf >> generator;
+	sigma.resize((size_t(N)*V+63)/64);
+	in.read(sigma.data(), sigma.size());
+	results.clear();
+	in.read(n);
+	for (uint32_t k=0;k<n && in.good();k++) {
+		std::string key, name;
+		uint32_t b = 0;
+		in.read_string(key);
+		in.read_string(name);
+		in.read(b);
+		if (!in.good() || b>64) return false;
+		mymeasurement<double> &m = results[key];
+		m.set_name(name);
+		m.set_bins(b);
+		int32_t samples[64];
+		double values[64];
+		in.read(samples, b);
+		for (uint32_t i=0;i<b;i++) m.set_samples(i, samples[i]);
+		in.read(values, b);
+		for (uint32_t i=0;i<b;i++) m.set_sum(i, values[i]);
+		in.read(values, b);
+		for (uint32_t i=0;i<b;i++) m.set_squared_sum(i, values[i]);
+		in.read(values, b);
+		for (uint32_t i=0;i<b;i++) m.set_last_value(i, values[i]);
+	}
+	return in.good();
+}
+
+void Simulation::checkpoint (SimulationCheckpoint &c) const {
+	c.generator = generator;
+	c.time_shift = time_shift;
+	c.results["sign"] = sign;
+	c.results["acceptance"] = acceptance;
+	c.results["density"] = density;
+	c.results["magnetization"] = magnetization;
+	c.results["order_parameter"] = order_parameter;
+	c.results["chi_af"] = chi_af;
+	c.results["exact_sign"] = exact_sign;
+	c.results["chi_d"] = chi_d;
+	c.N = N;
+	c.V = V;
+	c.Lx = Lx;
+	c.Ly = Ly;
+	c.Lz = Lz;
+	c.sigma.assign((size_t(N)*V+63)/64, 0);
 	for (int i=0;i<N;i++) {
 		for (int j=0;j<V;j++) {
-			lua_pushnumber(L, diagonals[i][j]);
-			lua_rawseti(L, -2, i*V+j+1);
-			//std::cerr << (diagonals[i][j]<0.0?'-':'+') << ' ';
+			if (field.up(i, j)) c.sigma[(i*V+j)/64] |= uint64_t(1) << ((i*V+j)%64);
 		}
 	}
-	//std::cerr << std::endl;
-	lua_setfield(L, -2, "sigma");
+}
+
+void Simulation::restore (const SimulationCheckpoint &c) {
+	generator = c.generator;
+	time_shift = c.time_shift%N;
+	auto restore_result = [&c] (const char *name, mymeasurement<double> &m) {
+		auto iter = c.results.find(name);
+		if (iter!=c.results.end()) m = iter->second;
+	};
+	restore_result("sign", sign);
+	restore_result("acceptance", acceptance);
+	restore_result("density", density);
+	restore_result("magnetization", magnetization);
+	restore_result("order_parameter", order_parameter);
+	restore_result("chi_af", chi_af);
+	restore_result("exact_sign", exact_sign);
+	restore_result("chi_d", chi_d);
+	int oldN = c.N;
+	int oldV = c.V;
+	if (oldN>0 && oldV>0 && c.sigma.size()==(size_t(oldN)*oldV+63)/64) {
+		for (int i=0;i<N;i++) {
+			int t = oldN<N?i%oldN:i;
+			for (int j=0;j<V;j++) {
+				int x = j%oldV;
+				field.set(i, j, c.up(t*oldV+x));
+			}
+		}
+	}
+	std::tie(plog, psign) = make_svd_inverse();
+	reset_updates();
+}
+
+// starts from the field of a neighbouring point of a parameter scan and
+// nothing else: the field is stretched in imaginary time if the number of
+// slices changed (a new beta) and tiled along each direction if the lattice
+// grew; without the old sizes the flat site index wraps instead
+void Simulation::warm_start (const SimulationCheckpoint &c) {
+	if (c.N<=0 || c.V<=0 || c.sigma.size()!=(size_t(c.N)*c.V+63)/64) return;
+	const bool tiled = c.Lx>0 && c.Ly>0 && c.Lz>0 && c.Lx*c.Ly*c.Lz==c.V;
+	for (int i=0;i<N;i++) {
+		int t = int((long(i)*c.N)/N);
+		for (int j=0;j<V;j++) {
+			int x = (j/Lz/Ly)%Lx, y = (j/Lz)%Ly, z = j%Lz;
+			int k = tiled?((x%c.Lx)*c.Ly+y%c.Ly)*c.Lz+z%c.Lz:j%c.V;
+			field.set(i, j, c.up(t*c.V+k));
+		}
+	}
+	std::tie(plog, psign) = make_svd_inverse();
+	reset_updates();
+}
+
+bool Simulation::load_checkpoint (lua_State *L) {
+	PHASE_TIMER(checkpoint_io);
+	SimulationCheckpoint c;
+	if (!c.load(L)) return false;
+	restore(c);
+	return true;
+}
+
+void Simulation::save_checkpoint (lua_State *L) {
+	PHASE_TIMER(checkpoint_io);
+	SimulationCheckpoint c;
+	checkpoint(c);
+	c.save(L);
 }
 
 std::pair<double, double> Simulation::rank1_probability (int x) {
+	PHASE_TIMER(proposal);
 	int L = update_size;
 	int j;
 	double d1, d2;
@@ -360,12 +596,12 @@ std::pair<double, double> Simulation::rank1_probability (int x) {
 	return std::pair<double, double>(std::log(d1)+std::log(d2), s);
 }
 
-bool Simulation::metropolis () {
+// flips site x if log(u) is below the log of the acceptance ratio
+bool Simulation::metropolis (int x, double u) {
 	steps++;
 	bool ret = false;
-	int x = randomPosition(generator);
 	std::pair<double, double> r1 = rank1_probability(x);
-	ret = -trialDistribution(generator)<r1.first-update_prob;
+	ret = std::log(u)<r1.first-update_prob;
 	if (ret) {
 		//std::cerr << "accepted " << x << ' ' << update_size << std::endl;
 		update_size = new_update_size;
@@ -385,7 +621,7 @@ void Simulation::load_sigma (lua_State *L, const char *fn) {
 		lua_rawgeti(L, -1, t+1);
 		for (int x=0;x<V;x++) {
 			lua_rawgeti(L, -1, x+1);
-			diagonals[t][x] = lua_tonumber(L, -1)<0?-A:A;
+			field.set(t, x, lua_tonumber(L, -1)>=0);
 			lua_pop(L, 1);
 		}
 		lua_pop(L, 1);
@@ -394,25 +630,26 @@ void Simulation::load_sigma (lua_State *L, const char *fn) {
 }
 
 void Simulation::write_wavefunction (std::ostream &out) {
-	for (auto d : diagonals) {
-		out << (d.array()>Array_d::Zero(V)).transpose() << std::endl;
+	for (int t=0;t<N;t++) {
+		for (int x=0;x<V;x++) out << (x>0?" ":"") << field.up(t, x);
+		out << std::endl;
 	}
 	out << std::endl;
 }
 
-std::pair<double, double> Simulation::recheck () {
-	const int prec = 2048;
-	PreciseMatrix A(prec), W(prec), A1(prec), A2(prec);
-	PreciseMatrix C(prec), Q(prec), wr(prec), wi(prec);
+std::pair<double, int> Simulation::exact_determinant (int prec, PreciseMatrix &A) {
+	PreciseMatrix A1(prec), A2(prec);
+	A.set_precision(prec);
+	A1.set_pool(A.pool());
+	A2.set_pool(A.pool());
 	A = Matrix_d::Identity(V, V);
+	Vector_d d_i;
 	for (int i=0;i<N;i++) {
-		//A.applyOnTheLeft(freePropagator_matrix*((Vector_d::Constant(V, 1.0)+diagonal(i)).array()).matrix().asDiagonal());
-	}
-	for (int i=0;i<N;i++) {
-		A.applyOnTheLeft(((Vector_d::Constant(V, 1.0)+diagonal(i)).array()).matrix().asDiagonal());
+		field.expand(slice(i), 1.0+this->A, 1.0-this->A, d_i); // the coupling, A is the product here
+		A.scale_rows(d_i);
 		A.applyOnTheLeft(freePropagator_matrix);
 	}
-	A2 = A1 = W = A;
+	A2 = A1 = A;
 	A1 *= std::exp(beta*B/2+beta*mu);
 	A2 *= std::exp(-beta*B/2+beta*mu);
 	A1 += Matrix_d::Identity(V, V);
@@ -430,17 +667,90 @@ std::pair<double, double> Simulation::recheck () {
 	int sign = s1*s2*mpfr_sgn(d);
 	mpfr_abs(d, d, A.rnd());
 	mpfr_log(d, d, A.rnd());
+	double ret = mpfr_get_d(d, A.rnd());
+	mpfr_clear(d);
+	return std::pair<double, int>(ret, sign);
+}
+
+// the same as exact_determinant in a fixed precision scalar type
+template <typename T>
+std::pair<double, int> Simulation::fast_determinant () const {
+	typedef Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic> matrix_type;
+	matrix_type P = freePropagator_matrix.cast<T>();
+	matrix_type M = matrix_type::Identity(V, V);
+	Vector_d d_i;
+	for (int i=0;i<N;i++) {
+		field.expand(slice(i), 1.0+A, 1.0-A, d_i);
+		M = d_i.cast<T>().asDiagonal()*M;
+		M = P*M;
+	}
+	double ret = 0.0;
+	int sign = 1;
+	for (double b : { +B, -B }) {
+		matrix_type X = M*T(std::exp(beta*b/2+beta*mu));
+		X += matrix_type::Identity(V, V);
+		Eigen::PartialPivLU<matrix_type> lu(X);
+		sign *= lu.permutationP().determinant();
+		for (int i=0;i<V;i++) {
+			if (lu.matrixLU()(i, i)<T(0.0)) sign = -sign;
+			ret += log_abs(lu.matrixLU()(i, i));
+		}
+	}
+	return std::pair<double, int>(ret, sign);
+}
+
+std::pair<double, double> Simulation::recheck () {
+	// Start from the precision needed to hold the dynamic range of the
+	// product, as seen by the stabilized SVD, and accept the result when it
+	// is unchanged with 64 more bits. Otherwise double the precision and
+	// compare with the last result, so that no determinant is computed twice.
+	const int guard = 64;
+	const double tolerance = 1.0e-10;
+	double range = std::log2(svd.S.maxCoeff()/svd.S.minCoeff());
+	int prec = std::isfinite(range)?int(range)+guard:recheck_max_precision;
+	prec = (std::max(prec, recheck_precision)+63)/64*64;
+	prec = std::min(prec, recheck_max_precision);
+	if (!recheck_pool) recheck_pool.reset(new ThreadPool(recheck_threads));
+	PreciseMatrix A;
+	A.set_pool(recheck_pool.get());
+	double d, d_low;
+	int sign, sign_low;
+	bool fast = false;
+	if (recheck_dd) {
+		// rounding errors are amplified by the same factor in both types:
+		// if the double result is close, the double-double one is exact
+		// to many more digits than needed
+		std::tie(d, sign) = fast_determinant<dd_real>();
+		std::tie(d_low, sign_low) = fast_determinant<double>();
+		fast = sign==sign_low && std::fabs(d-d_low)<=1.0e-4*std::max(1.0, std::fabs(d));
+	}
+	if (fast) {
+		prec = 106;
+	} else {
+		std::tie(d_low, sign_low) = exact_determinant(prec, A);
+		int high = prec+guard;
+		while (true) {
+			std::tie(d, sign) = exact_determinant(high, A);
+			if (sign==sign_low && std::fabs(d-d_low)<=tolerance*std::max(1.0, std::fabs(d))) break;
+			if (high>=recheck_max_precision+guard) {
+				std::cerr << "recheck did not converge at " << high << " bits" << std::endl;
+				break;
+			}
+			d_low = d;
+			sign_low = sign;
+			high = std::min(2*high, recheck_max_precision+guard);
+		}
+		prec = high;
+	}
 	std::cout << "SVDs: " << svd.S.transpose() << '\n';
 	std::cout << "svd determinant: " << (psign<0.0?"-exp(":"exp(") << plog << ')';
 	if (sign<0) {
-		std::cout << ", exact probability: -exp(" << d << ')' << std::endl;
+		std::cout << ", exact probability: -exp(" << d << ')';
 	} else {
-		std::cout << ", exact probability: +exp(" << d << ')' << std::endl;
-	}
-	double r = 0.0;
-	for (auto d : diagonals) {
-		r += (d.array()>Array_d::Zero(V)).count();
+		std::cout << ", exact probability: +exp(" << d << ')';
 	}
+	std::cout << " at " << prec << " bits" << std::endl;
+	double r = field.count_up();
 	std::cout << "positive points = " << r/N/V << std::endl;
 	std::cout << "time_shift = " << time_shift << std::endl;
 	std::ofstream out;
@@ -462,115 +772,13 @@ std::pair<double, double> Simulation::recheck () {
 	write_wavefunction(out);
 	out.flush();
 	out.close();
-	r = mpfr_get_d(d, A.rnd());
-	mpfr_clear(d);
-	return std::pair<double, double>(r, sign<0?-1.0:1.0);
-	W.reduce_to_hessenberg();
-	W.extract_hessenberg_H(C);
-	C.reduce_to_ev(wr, wi);
-	int n1 = -1, n2 = -1;
-	for (int i=0;i<V;i++) {
-		if (mpfr_zero_p(wi.coeff(i, 0)) && mpfr_sgn(wr.coeff(i, 0))<0) {
-			if (n1==-1) {
-				n1 = i;
-			} else if (n2==-1) {
-				n2 = i;
-			} else {
-			}
-		}	
-		std::cout << '(' << wr.coeff(i, 0) << ", " << wi.coeff(i, 0) << ") ";
-	}
-	std::cout << std::endl;
-	A1 = A;
-	mpfr_t lambda;
-	mpfr_init2(lambda, prec);
-	mpfr_mul_d(lambda, wr.coeff(n1, 0), 1.00, A1.rnd());
-	for (int i=0;i<V;i++) {
-		mpfr_sub(A1.coeff(i, i), A1.coeff(i, i), lambda, A1.rnd());
-	}
-	std::cout << "todo: LU" << std::endl;
-	A1.in_place_LU(p);
-	std::cout << "LU done" << std::endl;
-	PreciseMatrix v(prec);
-	v = Matrix_d::Random(V, 1);
-	v.normalize();
-	//v.transpose_in_place(); std::cout << v << std::endl; v.transpose_in_place(); 
-	for (int i=0;i<150;i++) {
-		A1.apply_inverse_LU_vector(v, p);
-		v.normalize();
-		//v.transpose_in_place(); std::cout << v << std::endl; v.transpose_in_place(); 
-	}
-	v.transpose_in_place(); std::cout << "=======\n" << v << std::endl; v.transpose_in_place(); 
-	v.applyOnTheLeft(A);
-	v.normalize();
-	v.transpose_in_place(); std::cout << "=======\n" << v << std::endl; v.transpose_in_place(); 
-	std::ofstream wf("wf.dat");
-	wf.precision(18);
-	wf << "return {\n N = "<< (N+1) << ",\n Lx = " << Lx << ",\n Ly = " << Ly << ",\n Lz = " << Lz << ",\n dt = "<< dt << ",\n";
-	wf << " sigma = {\n";
-	for (int i=0;i<=N;i++) {
-		wf << "  {";
-		for (int j=0;j<V;j++) wf << " " << diagonal(i)[j] << ",";
-		wf << " },\n";
-	}
-	wf << " },\n";
-	wf << " wf1 = {\n";
-	mpfr_set_d(lambda, 1.0, A1.rnd());
-	for (int i=0;i<=N;i++) {
-		wf << "  {";
-		for (int j=0;j<V;j++) wf << " " << v.coeff(j, 0) << ",";
-		wf << " norm = " << lambda << ", },\n";
-		if (i==N) break;
-		v.applyOnTheLeft(freePropagator_matrix*((Vector_d::Constant(V, 1.0)+diagonal(i)).array()).matrix().asDiagonal());
-		v.get_norm(lambda);
-		v.normalize();
-	}
-	wf << " },\n";
-	wf << " wf2 = {\n";
-	wf << " },\n";
-	wf << "}\n";
-	wf.close();
-	mpfr_clear(lambda);
-	//throw "";
-	const int myV = V-2;
-	Matrix_d G0, ev0, ev, tmp;
-	Matrix_d overlaps = Matrix_d::Identity(myV, myV);
-	SVDHelper helper;
-	Eigen::SelfAdjointEigenSolver<Matrix_d> solver;
-	solver.compute(hamiltonian);
-	G0 = solver.eigenvectors() * (-0.5*dt*solver.eigenvalues().array()).exp().matrix().asDiagonal() * solver.eigenvectors().transpose();
-	for (int i=0;i<10;i++) {
-		solver.compute(G0*(Vector_d::Constant(V, 1.0)+diagonal(i)).asDiagonal()*G0);
-		if (i!=0) {
-			tmp = ev.transpose()*solver.eigenvectors().leftCols(myV);
-			helper.fullSVD(tmp);
-			overlaps.applyOnTheRight(helper.Vt.transpose()*helper.U.transpose());
-		}
-		ev = solver.eigenvectors().leftCols(myV);
-		if (i==0) ev0 = ev;
-		//std::cerr << "i=" << i << "; overlaps = " << overlaps.transpose() << std::endl;
-	}
-	tmp = ev.transpose()*ev0;
-	helper.fullSVD(tmp);
-	overlaps.applyOnTheRight(helper.Vt.transpose()*helper.U.transpose());
-	std::cerr << "===\n" << overlaps.transpose() << std::endl << std::endl;
+	r = d;
 	return std::pair<double, double>(r, sign<0?-1.0:1.0);
 }
 
 void Simulation::straighten_slices () {
-	for (Vector_d& d : diagonals) {
-		bool up = true;
-		for (int i=0;i<V;i++) {
-			if (d[i]<0) {
-				up = false;
-				break;
-			}
-		}
-		if (up) {
-			for (int i=0;i<V;i++) {
-				d[i] = -d[i];
-			}
-		}
+	for (int t=0;t<N;t++) {
+		if (field.count_up(t)==V) field.set_slice(t, false);
 	}
 }
 
@@ -579,6 +787,7 @@ void Simulation::measure_sign () {
 }
 
 void Simulation::measure_quick () {
+	PHASE_TIMER(measurements);
 	double s = svd_sign();
 	double n_up = rho_up.diagonal().array().sum();
 	double n_dn = rho_dn.diagonal().array().sum();
@@ -598,7 +807,7 @@ void Simulation::measure_quick () {
 	for (int j=0;j<V;j++) {
 		double ssz = 0.0;
 		int x = j;
-		int y = shift_x(j, 1);
+		int y = correlations.neighbor(j, LatticeCorrelations::plus_x);
 		ssz += rho_up(x, x)*rho_up(y, y) + rho_dn(x, x)*rho_dn(y, y);
 		ssz -= rho_up(x, x)*rho_dn(y, y) + rho_dn(x, x)*rho_up(y, y);
 		ssz -= rho_up(x, y)*rho_up(y, x) + rho_dn(x, y)*rho_dn(y, x);
@@ -608,7 +817,31 @@ void Simulation::measure_quick () {
 	singlet.add(s*sum/V);
 }
 
+double Simulation::relative_error (const std::string &name) const {
+	// member and whether it is weighted by the sign
+	static const std::map<std::string, std::pair<mymeasurement<double> Simulation::*, bool>> observables = {
+		{ "acceptance", { &Simulation::acceptance, false } },
+		{ "sign", { &Simulation::sign, false } },
+		{ "density", { &Simulation::density, true } },
+		{ "magnetization", { &Simulation::magnetization, true } },
+		{ "singlet", { &Simulation::singlet, true } },
+		{ "order_parameter", { &Simulation::order_parameter, true } },
+		{ "chi_d", { &Simulation::chi_d, true } },
+		{ "chi_af", { &Simulation::chi_af, true } },
+		{ "kinetic", { &Simulation::kinetic, true } },
+		{ "interaction", { &Simulation::interaction, true } },
+	};
+	auto iter = observables.find(name);
+	if (iter==observables.end()) return std::numeric_limits<double>::quiet_NaN();
+	const mymeasurement<double> &m = this->*(iter->second.first);
+	if (!m.converged() || (iter->second.second && !sign.converged())) return std::numeric_limits<double>::infinity();
+	double ret = std::fabs(m.error()/m.mean());
+	if (iter->second.second) ret += std::fabs(sign.error()/sign.mean());
+	return std::isnan(ret)?std::numeric_limits<double>::infinity():ret;
+}
+
 void Simulation::measure () {
+	PHASE_TIMER(measurements);
 	double s = svd_sign();
 	rho_up = Matrix_d::Identity(V, V) - svdA.inverse();
 	rho_dn = svdB.inverse();
@@ -631,24 +864,21 @@ void Simulation::measure () {
 		d_up[i].add(s*rho_up(i, i));
 		d_dn[i].add(s*rho_dn(i, i));
 	}
-	double d_wave_chi = pair_correlation(rho_up, rho_dn);
-	Matrix_d F_up = svdA.inverse();
-	Matrix_d F_dn = Matrix_d::Identity(V, V) - svdB.inverse();
+	double d_wave_chi = correlations.pair_correlation(rho_up, rho_dn);
 	chi_d.add(s*d_wave_chi*beta);
 	double af_ =((rho_up.diagonal().array()-rho_dn.diagonal().array())*staggering).sum()/double(V);
 	chi_af.add(s*beta*af_*af_);
+	correlations.compute(rho_up, rho_dn);
+	const std::vector<double> &C = correlations.spin_correlation();
+	const std::vector<double> &D = correlations.density_correlation();
+	const std::vector<double> &S = correlations.structure_factor();
 	for (int k=1;k<=Lx/2;k++) {
-		double ssz = 0.0;
-		for (int j=0;j<V;j++) {
-			int x = j;
-			int y = shift_x(j, k);
-			ssz += rho_up(x, x)*rho_up(y, y) + rho_dn(x, x)*rho_dn(y, y);
-			ssz -= rho_up(x, x)*rho_dn(y, y) + rho_dn(x, x)*rho_up(y, y);
-			ssz -= rho_up(x, y)*rho_up(y, x) + rho_dn(x, y)*rho_dn(y, x);
-		}
-		spincorrelation[k].add(s*0.25*ssz);
-		if (std::isnan(ssz)) {
-		}
+		spincorrelation[k].add(s*0.25*C[correlations.site(k, 0, 0)]);
+	}
+	for (int r=0;r<V;r++) {
+		spin_correlation_r[r].add(s*0.25*C[r]/V);
+		density_correlation_r[r].add(s*D[r]/V);
+		structure_factor[r].add(s*0.25*S[r]/V);
 	}
 	//if (staggered_field!=0.0) staggered_magnetization.add(s*(rho_up.diagonal().array()*staggering - rho_dn.diagonal().array()*staggering).sum()/V);
 	get_green_function(s);
@@ -656,57 +886,32 @@ void Simulation::measure () {
 
 void Simulation::get_green_function (double s, int t0) {
 	double X = 1.0-A*A;
-	Matrix_d rho_up = Matrix_d::Identity(V, V) - svdA.inverse();
-	Matrix_d rho_dn = svdB.inverse();
-	SVDHelper help, flist[N+1], blist[N+1];
+	if (!gf_engine) gf_engine.reset(new TimeDisplacedEngine(gf_threads));
+	// the chains are built without the scalar factors, which differ between spins
+	gf_engine->build(N, V, [&] (int t, Matrix_d &U) {
+		U.applyOnTheLeft(freePropagator_matrix);
+		field.scale_rows((t+t0)%N, U, 1.0+A, 1.0-A);
+	}, [&] (int t, Matrix_d &U) {
+		field.scale_rows((t+t0)%N, U, 1.0-A, 1.0+A);
+		U.applyOnTheLeft(freePropagator_inverse);
+	});
 	// spin up
-	help.setIdentity(V);
-	for (int t=0;t<=N;t++) {
-		flist[t] = help;
-		help.U.applyOnTheLeft(freePropagator_matrix);
-		help.S *= std::exp(+dt*B*0.5+dt*mu);
-		help.U.applyOnTheLeft(((Vector_d::Constant(V, 1.0)+diagonals[(t+t0)%N]).array()).matrix().asDiagonal());
-		help.absorbU();
-	}
-	help.setIdentity(V);
-	for (int t=0;t<=N;t++) {
-		blist[t] = help;
-		help.U.applyOnTheLeft(((Vector_d::Constant(V, 1.0)-diagonals[(t+t0)%N]).array()).matrix().asDiagonal());
-		help.S *= std::exp(-dt*B*0.5-dt*mu)/X;
-		help.U.applyOnTheLeft(freePropagator_inverse);
-		help.absorbU();
-	}
-	for (int t=0;t<=N;t++) {
-		help = blist[N-t];
-		help.add_svd(flist[t]);
-		green_function_up[t].add(s*help.inverse());
-	}
+	gf_engine->evaluate(false, -dt*B*0.5-dt*mu-std::log(X), +dt*B*0.5+dt*mu, [&] (int t, const Matrix_d &G) {
+		green_function_up[t].add(s, G);
+	});
 	// spin down
-	help.setIdentity(V);
-	for (int t=0;t<=N;t++) {
-		flist[t] = help;
-		help.U.applyOnTheLeft(freePropagator_matrix);
-		help.S *= std::exp(-dt*B*0.5+dt*mu);
-		help.U.applyOnTheLeft(((Vector_d::Constant(V, 1.0)+diagonals[(t+t0)%N]).array()).matrix().asDiagonal());
-		help.absorbU();
-	}
-	help.setIdentity(V);
-	for (int t=0;t<=N;t++) {
-		blist[t] = help;
-		help.U.applyOnTheLeft(((Vector_d::Constant(V, 1.0)-diagonals[(t+t0)%N]).array()).matrix().asDiagonal());
-		help.S *= std::exp(+dt*B*0.5-dt*mu)/X;
-		help.U.applyOnTheLeft(freePropagator_inverse);
-		help.absorbU();
-	}
-	for (int t=0;t<=N;t++) {
-		help = flist[N-t];
-		help.add_svd(blist[t]);
-		green_function_dn[t].add(s*help.inverse());
-	}
+	gf_engine->evaluate(true, -dt*B*0.5+dt*mu, +dt*B*0.5-dt*mu-std::log(X), [&] (int t, const Matrix_d &G) {
+		green_function_dn[t].add(s, G);
+	});
 }
 
 void Simulation::write_green_function () {
 	if (gf_name.empty()) return;
+	if (gf_binary) {
+		write_green_function_binary();
+		return;
+	}
+	warn_green_function_errors();
 	std::ofstream out(gf_name);
 	Eigen::IOFormat HeavyFmt(Eigen::FullPrecision, 0, ", ", ",\n", "{", "}", "{", "}");
 	out << "beta = " << beta*tx << "\n";
@@ -738,6 +943,61 @@ void Simulation::write_green_function () {
 	}
 }
 
+void Simulation::warn_green_function_errors () const {
+	for (int t=0;t<=N;t++) {
+		if (green_function_up[t].samples()==0 || green_function_up[t].has_error()) continue;
+		std::cerr << "too few measurements for the Green's function errors at gf_error_level " << gf_error_level << ": writing NaN" << std::endl;
+		return;
+	}
+}
+
+void Simulation::write_green_function_binary () {
+	GreenFunctionHeader header;
+	header.beta = beta*tx;
+	header.dtau = dt*tx;
+	header.mu = mu/tx;
+	header.B = B/tx;
+	header.U = g/tx;
+	header.Lx = Lx;
+	header.Ly = Ly;
+	header.Lz = Lz;
+	header.N = N;
+	header.V = V;
+	header.sign = sign.mean();
+	header.dsign = sign.error();
+	warn_green_function_errors();
+	std::string tmp = gf_name + ".tmp";
+	std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+	out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+	const char padding[64] = { 0, };
+	out.write(padding, header.data_offset-sizeof(header));
+	// blocks are stored row major, i.e. as the column major transpose
+	Eigen::ArrayXXd G;
+	auto write_block = [&] (const std::vector<matrix_measurement> &gf, bool errors) {
+		for (int t=0;t<=N;t++) {
+			if (gf[t].samples()==0) {
+				G.setZero(V, V);
+			} else if (errors) {
+				gf[t].mean(G);
+				G = (G/sign.mean()).abs()*(gf[t].error()/G.abs() + sign.error()/fabs(sign.mean()));
+			} else {
+				gf[t].mean(G);
+				G /= sign.mean();
+			}
+			G.transposeInPlace();
+			out.write(reinterpret_cast<const char *>(G.data()), sizeof(double)*V*V);
+		}
+	};
+	write_block(green_function_up, false);
+	write_block(green_function_up, true);
+	write_block(green_function_dn, false);
+	write_block(green_function_dn, true);
+	out.close();
+	if (out.fail() || std::rename(tmp.c_str(), gf_name.c_str())!=0) {
+		std::cerr << "error writing Green's function to " << gf_name << std::endl;
+	}
+}
+
 bool Simulation::shift_time () {
 	bool ret = time_shift==N-1;
 	if (time_shift%5) {
@@ -771,11 +1031,11 @@ bool Simulation::shift_time_svd () {
 		svdB.add_identity(std::exp(-beta*B*0.5+beta*mu));
 		rho_up = Matrix_d::Identity(V, V) - svdA.inverse();
 		update_matrix_up = rho_up;
-		update_matrix_up.applyOnTheLeft(-2.0*(diagonal(0).array().inverse()+1.0).inverse().matrix().asDiagonal());
+		field.scale_rows(slice(0), update_matrix_up, -2.0*A/(1.0+A), 2.0*A/(1.0-A));
 		update_matrix_up.diagonal() += Vector_d::Ones(V);
 		rho_dn = svdB.inverse();
 		update_matrix_dn = Matrix_d::Identity(V, V) - rho_dn;
-		update_matrix_dn.applyOnTheLeft(-2.0*(diagonal(0).array().inverse()+1.0).inverse().matrix().asDiagonal());
+		field.scale_rows(slice(0), update_matrix_dn, -2.0*A/(1.0+A), 2.0*A/(1.0-A));
 		update_matrix_dn.diagonal() += Vector_d::Ones(V);
 		plog = svd_probability();
 		psign = svd_sign();
@@ -793,10 +1053,11 @@ bool Simulation::shift_time_svd () {
 void Simulation::accumulate_forward (int start, int end, Matrix_d &G_up, Matrix_d &G_dn) {
 	while (end>N) end -= N;
 	for (int i=start;i<end;i++) {
-		G_up.applyOnTheLeft(((Vector_d::Constant(V, 1.0)+diagonals[i]).array()).matrix().asDiagonal());
+		field.scale_rows(i, G_up, 1.0+A, 1.0-A);
 		if (false) {
 			svdA.U.applyOnTheLeft(freePropagator_matrix);
 		} else {
+			PHASE_TIMER(fft);
 			G_up.applyOnTheLeft(freePropagator_x.asDiagonal());
 			fftw_execute_dft_r2c(x2p_col, G_up.data(), reinterpret_cast<fftw_complex*>(momentumSpace.data()));
 			momentumSpace.applyOnTheLeft((freePropagator_diagonal/double(V)).asDiagonal());
@@ -804,10 +1065,11 @@ void Simulation::accumulate_forward (int start, int end, Matrix_d &G_up, Matrix_
 		}
 	}
 	for (int i=start;i<end;i++) {
-		G_dn.applyOnTheLeft(((Vector_d::Constant(V, 1.0)+diagonals[i]).array()).matrix().asDiagonal());
+		field.scale_rows(i, G_dn, 1.0+A, 1.0-A);
 		if (false) {
 			G_dn.applyOnTheLeft(freePropagator_matrix);
 		} else {
+			PHASE_TIMER(fft);
 			G_dn.applyOnTheLeft(freePropagator_x.array().inverse().matrix().asDiagonal());
 			fftw_execute_dft_r2c(x2p_col, G_dn.data(), reinterpret_cast<fftw_complex*>(momentumSpace.data()));
 			momentumSpace.applyOnTheLeft((freePropagator_diagonal.array().inverse().matrix()/double(V)).asDiagonal());
@@ -6,10 +6,22 @@
 #include "svd.hpp"
 #include "types.hpp"
 #include "measurements.hpp"
-
+#include "matrix_measurement.hpp"
+#include "time_displaced.hpp"
+#include "correlations.hpp"
+#include "auxiliary_field.hpp"
+#include "philox.hpp"
+#include "timers.hpp"
+
+#include <cstdint>
 #include <fstream>
 #include <random>
 #include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <algorithm>
 
 extern "C" {
 #include <fftw3.h>
@@ -27,6 +39,68 @@ static const double pi = 3.141592653589793238462643383279502884197;
 
 template <typename T> using mymeasurement = measurement<T, false>;
 
+class PreciseMatrix;
+
+// Everything needed to construct a Simulation. It is read from the job table
+// once, so that the simulation itself never needs access to the Lua state.
+struct SimulationParameters {
+	config::hubbard_config config;
+	bool has_seed; // SEED was given as a number
+	unsigned long seed;
+	uint64_t stream; // Philox stream of seed: main uses the job index, so jobs sharing a SEED (or none) differ
+	std::string seed_state; // SEED was given as a serialized generator
+	double w_x, w_y, w_z;
+	bool reset;
+	std::string outfn;
+	std::string gf_name;
+	bool gf_binary; // write the Green's function in binary instead of Lua
+	int gf_levels; // binning levels of the Green's function accumulators
+	int gf_error_level; // if >=0 only this level is kept for error estimates
+	int gf_threads; // threads used for the time-displaced Green's function
+	int recheck_threads; // threads used for the exact sign recheck
+	int recheck_precision; // lowest precision (bits) tried by the recheck
+	int recheck_max_precision;
+	bool recheck_dd; // try double-double arithmetic before MPFR
+	int mslices;
+	int msvd;
+	int flips_per_update;
+	bool use_fft;
+
+	SimulationParameters () : has_seed(false), seed(0), stream(0), w_x(0.0), w_y(0.0), w_z(0.0),
+		reset(false), gf_binary(true), gf_levels(16), gf_error_level(-1), gf_threads(1), recheck_threads(1), recheck_precision(128), recheck_max_precision(4096), recheck_dd(false), mslices(0), msvd(0), flips_per_update(0), use_fft(false) {}
+
+	void load (lua_State *L, int index);
+};
+
+// State of the Markov chain and accumulated results, as stored in a savefile.
+struct SimulationCheckpoint {
+	Philox generator;
+	int time_shift;
+	int N, V;
+	int Lx, Ly, Lz; // 0 if unknown, as in version 2 files
+	std::vector<uint64_t> sigma; // N*V field values packed as bits, set for +1
+	std::map<std::string, mymeasurement<double>> results;
+	int thermalization; // remaining thermalization sweeps
+	int sweeps; // remaining measurement sweeps
+
+	SimulationCheckpoint () : time_shift(0), N(0), V(0), Lx(0), Ly(0), Lz(0), thermalization(0), sweeps(0) {}
+
+	bool up (size_t i) const { return (sigma[i/64] >> (i%64)) & 1; }
+
+	// false if SEED is not a Philox state, e.g. a Mersenne twister saved
+	// before version 2 of the binary format
+	bool load (lua_State *L);
+	void save (lua_State *L) const;
+
+	// binary format: magic, version, header, RNG state, field as packed
+	// bits, raw measurement bins and a trailing checksum
+	static const char magic[8];
+	static const uint32_t version = 3; // 1 stored a Mersenne twister, 2 had no lattice sizes
+	static bool is_binary (const std::string &fn);
+	bool write (const std::string &fn) const;
+	bool read (const std::string &fn, bool use_mmap = true);
+};
+
 #if 0
 static auto measurements_proto = make_named_tuple(
 		named_value2(mymeasurement<double>(), acceptance),
@@ -66,14 +140,15 @@ class Simulation {
 
 
 	//state
-	std::vector<Vector_d> diagonals;
-	std::vector<Vector_d> diagonals_saved;
+	AuxiliaryField field; // indexed by absolute time, see slice()
 
 	// Monte Carlo scheme settings
-	std::mt19937_64 generator;
+	Philox generator;
+	std::vector<double> proposals; // uniforms of one update, drawn in bulk
 	bool reset;
 	std::string outfn;
 	std::string gf_name;
+	bool gf_binary;
 	int mslices;
 	int msvd;
 	int flips_per_update;
@@ -128,9 +203,11 @@ class Simulation {
 
 	fftw_plan x2p_col;
 	fftw_plan p2x_col;
+	LatticeCorrelations correlations;
 
 	double plog;
 	double psign;
+	double drift; // largest change of the log weight found by redo_all
 
 	Matrix_d rho_up;
 	Matrix_d rho_dn;
@@ -156,12 +233,24 @@ class Simulation {
 	std::vector<mymeasurement<double>> d_up;
 	std::vector<mymeasurement<double>> d_dn;
 	std::vector<mymeasurement<double>> spincorrelation;
+	std::vector<mymeasurement<double>> spin_correlation_r; // <S_x S_{x+r}> per site
+	std::vector<mymeasurement<double>> density_correlation_r; // <n_x n_{x+r}> per site
+	std::vector<mymeasurement<double>> structure_factor; // S(q) per site
 	std::vector<mymeasurement<double>> error;
 	// RNG distributions
 	mymeasurement<double> staggered_magnetization;
 
-	std::vector<mymeasurement<Eigen::ArrayXXd>> green_function_up;
-	std::vector<mymeasurement<Eigen::ArrayXXd>> green_function_dn;
+	int gf_levels;
+	int gf_error_level;
+	int gf_threads;
+	std::unique_ptr<TimeDisplacedEngine> gf_engine;
+	int recheck_threads;
+	int recheck_precision;
+	int recheck_max_precision;
+	bool recheck_dd;
+	std::unique_ptr<ThreadPool> recheck_pool;
+	std::vector<matrix_measurement> green_function_up;
+	std::vector<matrix_measurement> green_function_dn;
 
 	int time_shift;
 
@@ -177,8 +266,14 @@ class Simulation {
 		return ((a+k+Ly)%Ly)*Lz + b;
 	}
 
-	const Vector_d& diagonal (int t) const { return diagonals[(t+time_shift)%N]; }
-	Vector_d& diagonal (int t) { return diagonals[(t+time_shift)%N]; }
+	int slice (int t) const { return (t+time_shift)%N; }
+
+	// field values +-A of time slice t, for the non critical paths
+	Vector_d diagonal (int t) const {
+		Vector_d ret;
+		field.expand(slice(t), A, -A, ret);
+		return ret;
+	}
 
 	public:
 
@@ -205,11 +300,14 @@ class Simulation {
 		}
 		for (int i=0;i<V;i++) {
 			spincorrelation.push_back(mymeasurement<double>());
+			spin_correlation_r.push_back(mymeasurement<double>());
+			density_correlation_r.push_back(mymeasurement<double>());
+			structure_factor.push_back(mymeasurement<double>());
 		}
 		for (int i=0;i<=N;i++) {
 			error.push_back(mymeasurement<double>());
-			green_function_up.push_back(mymeasurement<Eigen::ArrayXXd>());
-			green_function_dn.push_back(mymeasurement<Eigen::ArrayXXd>());
+			green_function_up.push_back(matrix_measurement("Green Function (up)", gf_levels, gf_error_level));
+			green_function_dn.push_back(matrix_measurement("Green Function (down)", gf_levels, gf_error_level));
 		}
 	}
 
@@ -223,24 +321,27 @@ class Simulation {
 
 	void init ();
 
+	void load (const SimulationParameters &p);
 	void load (lua_State *L, int index);
 	void save (lua_State *L, int index);
-	void load_checkpoint (lua_State *L);
+	void checkpoint (SimulationCheckpoint &c) const;
+	void restore (const SimulationCheckpoint &c);
+	void warm_start (const SimulationCheckpoint &c);
+	bool load_checkpoint (lua_State *L);
 	void save_checkpoint (lua_State *L);
 
+	Simulation (const SimulationParameters &p) : distribution(0.5), trialDistribution(1.0), steps(0) {
+		load(p);
+	}
+
 	Simulation (lua_State *L, int index) : distribution(0.5), trialDistribution(1.0), steps(0) {
 		load(L, index);
 	}
 
 	double logDetU_s (int x = -1, int t = -1) const {
-		int nspinup = 0;
-		for (int i=0;i<N;i++) {
-			for (int j=0;j<V;j++) {
-				if (diagonals[i][j]>0.0) nspinup++;
-			}
-		}
+		int nspinup = field.count_up();
 		if (x>=0 && t>=0) {
-			nspinup += diagonals[t][x]>0.0?-1:+1;
+			nspinup += field.up(t, x)?-1:+1;
 		}
 		return nspinup*std::log(1.0+A) + (N*V-nspinup)*std::log(1.0-A);
 	}
@@ -251,12 +352,14 @@ class Simulation {
 	void make_slices ();
 
 	void make_svd () {
+		PHASE_TIMER(slice_application);
 		svd.setIdentity(V);
 		for (int i=0;i<N;) {
-			svd.U.applyOnTheLeft(((Vector_d::Constant(V, 1.0)+diagonal(i)).array()).matrix().asDiagonal());
+			field.scale_rows(slice(i), svd.U, 1.0+A, 1.0-A);
 			if (!use_fft) {
 				svd.U.applyOnTheLeft(freePropagator_matrix);
 			} else {
+				PHASE_TIMER(fft);
 				fftw_execute_dft_r2c(x2p_col, svd.U.data(), reinterpret_cast<fftw_complex*>(momentumSpace.data()));
 				momentumSpace.applyOnTheLeft((freePropagator_diagonal/double(V)).asDiagonal());
 				fftw_execute_dft_c2r(p2x_col, reinterpret_cast<fftw_complex*>(momentumSpace.data()), svd.U.data());
@@ -267,12 +370,14 @@ class Simulation {
 	}
 
 	void make_plain () {
+		PHASE_TIMER(slice_application);
 		plain.setIdentity(V, V);
 		for (int i=0;i<N;) {
-			plain.applyOnTheLeft(((Vector_d::Constant(V, 1.0)+diagonal(i)).array()).matrix().asDiagonal());
+			field.scale_rows(slice(i), plain, 1.0+A, 1.0-A);
 			if (!use_fft) {
 				plain.applyOnTheLeft(freePropagator_matrix);
 			} else {
+				PHASE_TIMER(fft);
 				fftw_execute_dft_r2c(x2p_col, plain.data(), reinterpret_cast<fftw_complex*>(momentumSpace.data()));
 				momentumSpace.applyOnTheLeft((freePropagator_diagonal/double(V)).asDiagonal());
 				fftw_execute_dft_c2r(p2x_col, reinterpret_cast<fftw_complex*>(momentumSpace.data()), plain.data());
@@ -282,12 +387,14 @@ class Simulation {
 	}
 
 	void make_svd_double () {
+		PHASE_TIMER(slice_application);
 		svdA.setIdentity(V);
 		for (int i=0;i<N;) {
-			svdA.U.applyOnTheLeft(((Vector_d::Constant(V, 1.0)+diagonal(i)).array()).matrix().asDiagonal());
+			field.scale_rows(slice(i), svdA.U, 1.0+A, 1.0-A);
 			if (!use_fft) {
 				svdA.U.applyOnTheLeft(freePropagator_matrix);
 			} else {
+				PHASE_TIMER(fft);
 				svdA.U.applyOnTheLeft(freePropagator_x.asDiagonal());
 				fftw_execute_dft_r2c(x2p_col, svdA.U.data(), reinterpret_cast<fftw_complex*>(momentumSpace.data()));
 				momentumSpace.applyOnTheLeft((freePropagator_diagonal/double(V)).asDiagonal());
@@ -298,10 +405,11 @@ class Simulation {
 		}
 		svdB.setIdentity(V);
 		for (int i=0;i<N;) {
-			svdB.U.applyOnTheLeft(((Vector_d::Constant(V, 1.0)+diagonal(i)).array()).matrix().asDiagonal());
+			field.scale_rows(slice(i), svdB.U, 1.0+A, 1.0-A);
 			if (!use_fft) {
 				svdB.U.applyOnTheLeft(freePropagator_inverse);
 			} else {
+				PHASE_TIMER(fft);
 				svdB.U.applyOnTheLeft(freePropagator_x.array().inverse().matrix().asDiagonal());
 				fftw_execute_dft_r2c(x2p_col, svdB.U.data(), reinterpret_cast<fftw_complex*>(momentumSpace.data()));
 				momentumSpace.applyOnTheLeft((freePropagator_diagonal.array().inverse().matrix()/double(V)).asDiagonal());
@@ -327,11 +435,11 @@ class Simulation {
 		std::pair<double, double> ret = make_density_matrices();
 		rho_up = Matrix_d::Identity(V, V) - svdA.inverse();
 		update_matrix_up = rho_up;
-		update_matrix_up.applyOnTheLeft(-2.0*(diagonal(0).array().inverse()+1.0).inverse().matrix().asDiagonal());
+		field.scale_rows(slice(0), update_matrix_up, -2.0*A/(1.0+A), 2.0*A/(1.0-A));
 		update_matrix_up.diagonal() += Vector_d::Ones(V);
 		rho_dn = svdB.inverse();
 		update_matrix_dn = Matrix_d::Identity(V, V) - rho_dn;
-		update_matrix_dn.applyOnTheLeft(-2.0*(diagonal(0).array().inverse()+1.0).inverse().matrix().asDiagonal());
+		field.scale_rows(slice(0), update_matrix_dn, -2.0*A/(1.0+A), 2.0*A/(1.0-A));
 		update_matrix_dn.diagonal() += Vector_d::Ones(V);
 		return ret;
 	}
@@ -343,13 +451,13 @@ class Simulation {
 		qr.compute(plainA);
 		rho_up = Matrix_d::Identity(V, V) - qr.inverse();
 		update_matrix_up = rho_up;
-		update_matrix_up.applyOnTheLeft(-2.0*(diagonal(0).array().inverse()+1.0).inverse().matrix().asDiagonal());
+		field.scale_rows(slice(0), update_matrix_up, -2.0*A/(1.0+A), 2.0*A/(1.0-A));
 		update_matrix_up.diagonal() += Vector_d::Ones(V);
 		ret.first += qr.logAbsDeterminant();
 		qr.compute(plainB);
 		rho_dn = qr.inverse();
 		update_matrix_dn = Matrix_d::Identity(V, V) - rho_dn;
-		update_matrix_dn.applyOnTheLeft(-2.0*(diagonal(0).array().inverse()+1.0).inverse().matrix().asDiagonal());
+		field.scale_rows(slice(0), update_matrix_dn, -2.0*A/(1.0+A), 2.0*A/(1.0-A));
 		update_matrix_dn.diagonal() += Vector_d::Ones(V);
 		ret.first += qr.logAbsDeterminant();
 		ret.second = (plainA*plainB).determinant()<0.0?-1.0:1.0;
@@ -369,11 +477,28 @@ class Simulation {
 		return (svdA.U*svdA.Vt*svdB.U*svdB.Vt).determinant()>0.0?1.0:-1.0;
 	}
 
+	// instantaneous sign and (signed) density and double occupancy, e.g. for
+	// equilibration checks
+	double current_sign () const { return psign*update_sign; }
+	double current_density () const { return current_sign()*(rho_up.trace()+rho_dn.trace())/V; }
+	double current_double_occupancy () const { return current_sign()*(rho_up.diagonal().array()*rho_dn.diagonal().array()).sum()/V; }
+
+	// largest difference between the log weight accumulated by the updates
+	// and its recomputation from scratch, since init()
+	double max_drift () const { return drift; }
+
+	// relative error of a scalar result, adding the relative error of the
+	// sign for sign-weighted observables; infinite while the binning
+	// analysis has not converged, NaN for unknown names
+	double relative_error (const std::string &name) const;
+
 	void accumulate_forward (int start, int end, Matrix_d &G_up, Matrix_d &G_dn);
 
 	void redo_all () {
+		PHASE_TIMER(propagators);
 		double np, ns;
 		std::tie(np, ns) = make_plain_inverse();
+		drift = std::max(drift, fabs(np-plog-update_prob));
 		if (fabs(np-plog-update_prob)>1.0e-8 || psign*update_sign!=ns) {
 			std::cerr << "redo " << plog+update_prob << " <> " << np << " ~~ " << np-plog-update_prob << '\t' << (psign*update_sign*ns) << std::endl;
 			plog = np;
@@ -390,8 +515,10 @@ class Simulation {
 	}
 
 	void redo_all_svd () {
+		PHASE_TIMER(propagators);
 		double np, ns;
 		std::tie(np, ns) = make_svd_inverse();
+		drift = std::max(drift, fabs(np-plog-update_prob));
 		if (fabs(np-plog-update_prob)>1.0e-8 || psign*update_sign!=ns) {
 			std::cerr << "redo " << plog+update_prob << " <> " << np << " ~~ " << np-plog-update_prob << '\t' << (psign*update_sign*ns) << std::endl;
 			plog = np;
@@ -408,39 +535,42 @@ class Simulation {
 	}
 
 	void apply_updates () {
+		PHASE_TIMER(accepted_update);
 		for (int i=0;i<update_size;i++) {
 			int x = update_perm[i];
-			diagonal(0)[x] = -diagonal(0)[x];
+			field.flip(slice(0), x);
 		}
 	}
 
 	std::pair<double, double> rank1_probability (int x);
 
-	bool metropolis ();
+	bool metropolis (int x, double u);
 
-	void remove_first_slice (Matrix_d &A) {
+	void remove_first_slice (Matrix_d &M) {
 		if (use_fft) {
-			A.applyOnTheRight((Vector_d::Constant(V, 1.0)+diagonal(0)).array().inverse().matrix().asDiagonal());
-			A.transposeInPlace();
-			fftw_execute_dft_r2c(x2p_col, A.data(), reinterpret_cast<fftw_complex*>(momentumSpace.data()));
+			PHASE_TIMER(fft);
+			field.scale_cols(slice(0), M, 1.0/(1.0+A), 1.0/(1.0-A));
+			M.transposeInPlace();
+			fftw_execute_dft_r2c(x2p_col, M.data(), reinterpret_cast<fftw_complex*>(momentumSpace.data()));
 			momentumSpace.applyOnTheLeft((freePropagator_diagonal.array().inverse().matrix()/double(V)).asDiagonal());
-			fftw_execute_dft_c2r(p2x_col, reinterpret_cast<fftw_complex*>(momentumSpace.data()), A.data());
-			A.transposeInPlace();
+			fftw_execute_dft_c2r(p2x_col, reinterpret_cast<fftw_complex*>(momentumSpace.data()), M.data());
+			M.transposeInPlace();
 		} else {
-			A.applyOnTheRight((Vector_d::Constant(V, 1.0)+diagonal(0)).array().inverse().matrix().asDiagonal());
-			A.applyOnTheRight(freePropagator_inverse);
+			field.scale_cols(slice(0), M, 1.0/(1.0+A), 1.0/(1.0-A));
+			M.applyOnTheRight(freePropagator_inverse);
 		}
 	}
 
-	void queue_first_slice (Matrix_d &A) {
+	void queue_first_slice (Matrix_d &M) {
 		if (use_fft) {
-			A.applyOnTheLeft(((Vector_d::Constant(V, 1.0)+diagonal(0)).array()).matrix().asDiagonal());
-			fftw_execute_dft_r2c(x2p_col, A.data(), reinterpret_cast<fftw_complex*>(momentumSpace.data()));
+			PHASE_TIMER(fft);
+			field.scale_rows(slice(0), M, 1.0+A, 1.0-A);
+			fftw_execute_dft_r2c(x2p_col, M.data(), reinterpret_cast<fftw_complex*>(momentumSpace.data()));
 			momentumSpace.applyOnTheLeft((freePropagator_diagonal.array().matrix()/double(V)).asDiagonal());
-			fftw_execute_dft_c2r(p2x_col, reinterpret_cast<fftw_complex*>(momentumSpace.data()), A.data());
+			fftw_execute_dft_c2r(p2x_col, reinterpret_cast<fftw_complex*>(momentumSpace.data()), M.data());
 		} else {
-			A.applyOnTheLeft(((Vector_d::Constant(V, 1.0)+diagonal(0)).array()).matrix().asDiagonal());
-			A.applyOnTheLeft(freePropagator_matrix);
+			field.scale_rows(slice(0), M, 1.0+A, 1.0-A);
+			M.applyOnTheLeft(freePropagator_matrix);
 		}
 	}
 
@@ -453,7 +583,7 @@ class Simulation {
 		std::vector<Matrix_d> v(N);
 		for (int i=0;i<N;i++) {
 			v[i] = freePropagator_matrix;
-			v[i].applyOnTheLeft(((Vector_d::Constant(V, 1.0)+diagonal(i)).array()).matrix().asDiagonal());
+			field.scale_rows(slice(i), v[i], 1.0+A, 1.0-A);
 			v[i] *= std::exp(-dt*(-mu-0.5*B));
 		}
 		SVDHelper help;
@@ -466,9 +596,13 @@ class Simulation {
 		return 1.0;
 	}
 
+	// a site and an acceptance threshold per flip
 	void update () {
+		proposals.resize(2*flips_per_update);
+		generator.generate_uniform(proposals.data(), proposals.size());
 		for (int i=0;i<flips_per_update;i++) {
-			acceptance.add(metropolis()?1.0:0.0);
+			int x = std::min(int(proposals[2*i]*V), V-1);
+			acceptance.add(metropolis(x, proposals[2*i+1])?1.0:0.0);
 			measured_sign.add(psign*update_sign);
 		}
 		shift_time_svd();
@@ -481,31 +615,7 @@ class Simulation {
 	}
 
 	double pair_correlation (const Matrix_d& rho_up, const Matrix_d& rho_dn) {
-		double ret = 0.0;
-		for (int x=0;x<V;x++) {
-			for (int y=0;y<V;y++) {
-				double u = rho_up(x, y);
-				double d = 0.0;
-				d += rho_dn(shift_x(x, +1), shift_x(y, +1));
-				d += rho_dn(shift_x(x, -1), shift_x(y, +1));
-				d -= rho_dn(shift_y(x, +1), shift_x(y, +1));
-				d -= rho_dn(shift_y(x, -1), shift_x(y, +1));
-				d += rho_dn(shift_x(x, +1), shift_x(y, -1));
-				d += rho_dn(shift_x(x, -1), shift_x(y, -1));
-				d -= rho_dn(shift_y(x, +1), shift_x(y, -1));
-				d -= rho_dn(shift_y(x, -1), shift_x(y, -1));
-				d -= rho_dn(shift_x(x, +1), shift_y(y, +1));
-				d -= rho_dn(shift_x(x, -1), shift_y(y, +1));
-				d += rho_dn(shift_y(x, +1), shift_y(y, +1));
-				d += rho_dn(shift_y(x, -1), shift_y(y, +1));
-				d -= rho_dn(shift_x(x, +1), shift_y(y, -1));
-				d -= rho_dn(shift_x(x, -1), shift_y(y, -1));
-				d += rho_dn(shift_y(x, +1), shift_y(y, -1));
-				d += rho_dn(shift_y(x, -1), shift_y(y, -1));
-				ret += u*d;
-			}
-		}
-		return ret / V / V;
+		return correlations.pair_correlation(rho_up, rho_dn);
 	}
 
 
@@ -549,6 +659,8 @@ class Simulation {
 	}
 
 	void write_green_function ();
+	void write_green_function_binary ();
+	void warn_green_function_errors () const;
 
 	std::string params () {
 		std::ostringstream buf;
@@ -556,11 +668,10 @@ class Simulation {
 		return buf.str();
 	}
 
-	~Simulation () {
-		fftw_destroy_plan(x2p_col);
-		fftw_destroy_plan(p2x_col);
-	}
+	~Simulation ();
 
+	std::pair<double, int> exact_determinant (int prec, PreciseMatrix &A);
+	template <typename T> std::pair<double, int> fast_determinant () const;
 	std::pair<double, double> recheck ();
 	void straighten_slices ();
 
@@ -581,6 +692,9 @@ class Simulation {
 			d_up[i].clear();
 			d_dn[i].clear();
 			spincorrelation[i].clear();
+			spin_correlation_r[i].clear();
+			density_correlation_r[i].clear();
+			structure_factor[i].clear();
 		}
 	}
 
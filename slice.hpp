@@ -1,6 +1,8 @@
 #ifndef SLICE_HPP
 #define SLICE_HPP
 
+#include "timers.hpp"
+
 #include <set>
 #include <Eigen/Dense>
 #include <cmath>
@@ -31,6 +33,22 @@ class Slice {
 		size_t remove (const Vertex &v) { return verts.erase(v); }
 		void clear () { verts.clear(); }
 
+		template <typename F>
+		void for_each_vertex (F f) const {
+			for (const Vertex &v : verts) f(v);
+		}
+
+		// rebuilds every vertex with f, e.g. after the interaction changed
+		template <typename F>
+		void transform_vertices (F f) {
+			std::set<Vertex, typename Vertex::Compare> old;
+			old.swap(verts);
+			for (Vertex v : old) {
+				f(v);
+				verts.insert(v);
+			}
+		}
+
 		Vertex get_vertex (size_t i) const {
 			auto iter = verts.begin();
 			std::advance(iter, i);
@@ -40,6 +58,7 @@ class Slice {
 		// apply the slice with forward propagators and direct vertices
 		template <typename T>
 		void apply_matrix (T &A) {
+			PHASE_TIMER(slice_application);
 			for (auto v=verts.begin();v!=verts.end();v++) {
 				I->apply_displaced_vertex_on_the_left(*v, A);
 			}
@@ -49,6 +68,7 @@ class Slice {
 		// apply the slice with forward propagators and direct vertices
 		template <typename T>
 		void apply_on_the_right (T &A) {
+			PHASE_TIMER(slice_application);
 			I->propagate_on_the_right(beta, A);
 			for (auto v=verts.rbegin();v!=verts.rend();v++) {
 				I->apply_displaced_vertex_on_the_right(*v, A);
@@ -14,6 +14,7 @@
 #include "weighted_measurements.hpp"
 #include "logger.hpp"
 #include "svd.hpp"
+#include "philox.hpp"
 
 extern "C" {
 #include <fftw3.h>
@@ -50,7 +51,7 @@ class Simulation {
 
 	std::vector<Vector_d> diagonals;
 
-	std::mt19937_64 generator;
+	Philox generator;
 	std::bernoulli_distribution distribution;
 	std::uniform_int_distribution<int> randomPosition;
 	std::uniform_int_distribution<int> randomTime;
@@ -5,6 +5,8 @@
 #include <Eigen/QR>
 #include <Eigen/SVD>
 
+#include "timers.hpp"
+
 #include <iostream>
 
 #if !defined EIGEN_USE_MKL_ALL
@@ -156,6 +158,7 @@ struct SVDHelper {
 
 	// this will only work if M>=N
 	void absorbU () {
+		PHASE_TIMER(stabilization);
 		const int M = U.rows();
 		const int N = U.cols();
 		int info = 0;
@@ -212,6 +215,7 @@ struct SVDHelper {
 
 	// TODO size constraints!
 	void add_identity (double lambda = 1.0) {
+		PHASE_TIMER(stabilization);
 		const int N = S.size();
 		int info = 0;
 		A = U; // FIXME: allocation -> is this cache friendly?
@@ -225,14 +229,17 @@ struct SVDHelper {
 		Vt.applyOnTheRight(B);
 	}
 
+	// adds lambda*s, reusing the A and B buffers
 	// TODO size constraints!
-	void add_svd (const SVDHelper &s) {
+	void add_svd (const SVDHelper &s, double lambda = 1.0) {
+		PHASE_TIMER(stabilization);
 		const int N = S.size();
 		int info = 0;
-		Matrix A = U;
-		Matrix B = s.Vt;
-		other = (U.transpose()*s.U) * s.S.asDiagonal();
-		other += S.asDiagonal() * (Vt*s.Vt.transpose());
+		A = U;
+		B = s.Vt;
+		other.noalias() = (U.transpose()*s.U) * (lambda*s.S).asDiagonal();
+		other.noalias() += S.asDiagonal() * (Vt*s.Vt.transpose());
+		reserve(6*N);
 		mydgesvd("A", "A", N, N, other.data(), N, S.data(), U.data(), N, Vt.data(), N, work.data(), work.size(), info);
 		check_info(info);
 		U.applyOnTheLeft(A);
@@ -247,6 +254,12 @@ struct SVDHelper {
 		return Vt.transpose() * S.array().inverse().matrix().asDiagonal() * U.transpose();
 	}
 
+	// inverse into preallocated storage, uses the other buffer
+	void inverse (Matrix &ret) {
+		other = S.array().inverse().matrix().asDiagonal() * U.transpose();
+		ret.noalias() = Vt.transpose() * other;
+	}
+
 	void transposeInPlace () {
 		U.swap(Vt);
 		U.transposeInPlace();
@@ -0,0 +1,52 @@
+#ifndef BENCHMARK_HPP
+#define BENCHMARK_HPP
+
+#include <chrono>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <iostream>
+
+// Timing of single kernels, one tab separated line per measurement:
+//
+//   kernel sites density calls ns_min ns_median
+//
+// sites is the lattice size and density the vertices (or flips) per site
+// the kernel works on, 0 where it does not apply. After one warm-up call the
+// number of calls per run is doubled until a run takes min_time/runs, then
+// runs runs are timed and the minimum and median time per call reported.
+// The minimum is the stable figure for regressions, the median shows the
+// noise of the machine.
+class Benchmark {
+	typedef std::chrono::steady_clock clock;
+
+	std::ostream &out_;
+	double min_time_;
+	int runs_;
+
+	template <typename F>
+	static double run (F &f, size_t calls) {
+		clock::time_point t0 = clock::now();
+		for (size_t i=0;i<calls;i++) f();
+		return std::chrono::duration<double>(clock::now()-t0).count();
+	}
+
+	public:
+	Benchmark (std::ostream &out, double min_time = 0.5, int runs = 5) : out_(out), min_time_(min_time), runs_(std::max(runs, 1)) {}
+
+	void header () { out_ << "kernel\tsites\tdensity\tcalls\tns_min\tns_median" << std::endl; }
+
+	template <typename F>
+	void operator() (const std::string &name, size_t sites, double density, F f) {
+		size_t calls = 1;
+		run(f, 1);
+		while (run(f, calls)<min_time_/runs_) calls *= 2;
+		std::vector<double> t(runs_);
+		for (double &x : t) x = 1.0e9*run(f, calls)/calls;
+		std::sort(t.begin(), t.end());
+		out_ << name << '\t' << sites << '\t' << density << '\t' << calls << '\t' << t.front() << '\t' << t[runs_/2] << std::endl;
+	}
+};
+
+#endif // BENCHMARK_HPP
+
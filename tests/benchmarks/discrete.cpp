@@ -0,0 +1,65 @@
+#include "benchmark.hpp"
+
+#include "simulation.hpp"
+#include "parameters.hpp"
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <iostream>
+
+using namespace std;
+
+Simulation *square (const Parameters &params, int L, bool use_fft) {
+	SimulationParameters p;
+	p.config.Lx = L;
+	p.config.Ly = L;
+	p.config.Lz = 1;
+	p.config.N = params.getInteger("slices", 40);
+	p.config.beta = params.getNumber("beta", 4.0);
+	p.config.U = params.getNumber("U", 4.0);
+	p.config.mu = 0.0;
+	p.config.B = 0.0;
+	p.config.tx = p.config.ty = 1.0;
+	p.config.tz = 0.0;
+	p.has_seed = true;
+	p.seed = params.getInteger("SEED", 42);
+	p.use_fft = use_fft;
+	return new Simulation(p);
+}
+
+// kernels of the discrete field code on square lattices of side 4 to
+// max_side: the single slice propagator with and without FFTs, the full
+// product of the slices, and rank1_probability with 1/8 to 1/2 of the
+// sites already flipped in the pending update (the density column).
+//
+// usage: discrete [--max_side 16] [--min_time 0.5] [--slices 40] [--beta 4] [--U 4]
+int main (int argc, char **argv) {
+	Parameters params(argc, argv);
+	const int max_side = params.getInteger("max_side", 16);
+	Benchmark bench(cout, params.getNumber("min_time", 0.5));
+	const vector<double> densities = { 0.125, 0.25, 0.5, };
+	bench.header();
+	for (int L=4;L<=max_side;L*=2) {
+		const int V = L*L;
+		for (bool use_fft : { false, true, }) {
+			unique_ptr<Simulation> sim(square(params, L, use_fft));
+			// the input is reset on every call so that it does not overflow
+			const Matrix_d M0 = Matrix_d::Random(V, V);
+			Matrix_d M;
+			const string kind = use_fft?"(fft)":"(dense)";
+			bench("Simulation::queue_first_slice"+kind, V, 0.0, [&] () { M = M0; sim->queue_first_slice(M); });
+			bench("Simulation::make_svd"+kind, V, 0.0, [&] () { sim->make_svd(); });
+		}
+		unique_ptr<Simulation> sim(square(params, L, true));
+		for (double density : densities) {
+			const int n = density*V;
+			sim->reset_updates();
+			for (int x=0;x<n;x++) sim->metropolis(x, 0.0); // always accepted
+			int k = 0;
+			bench("Simulation::rank1_probability", V, density, [&] () { sim->rank1_probability(n+k++%(V-n)); });
+		}
+	}
+	return 0;
+}
+
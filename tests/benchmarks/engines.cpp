@@ -0,0 +1,322 @@
+#include "simulation.hpp"
+#include "lctsimulation.hpp"
+#include "measurements.hpp"
+#include "parameters.hpp"
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <csignal>
+#include <cstdio>
+
+#include <chrono>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+using namespace std;
+using namespace std::chrono;
+
+typedef duration<double> seconds_type;
+
+struct Problem {
+	int L;
+	double beta;
+	double U;
+};
+
+struct Result {
+	size_t sweeps;
+	double seconds;
+	double tau; // integrated autocorrelation time of the double occupancy, in sweeps
+	double drift;
+};
+
+// thermalizes for a quarter of wall and then sweeps for the rest, recording
+// the value returned by sweep after each sweep
+template <typename F>
+Result run (double wall, F sweep) {
+	Result ret;
+	steady_clock::time_point t0 = steady_clock::now();
+	while (duration_cast<seconds_type>(steady_clock::now()-t0).count()<0.25*wall) sweep();
+	measurement<double> docc;
+	t0 = steady_clock::now();
+	ret.sweeps = 0;
+	do {
+		docc.add(sweep());
+		ret.sweeps++;
+	} while ((ret.seconds = duration_cast<seconds_type>(steady_clock::now()-t0).count())<0.75*wall);
+	ret.tau = std::max(docc.time(), 0.0);
+	ret.drift = 0.0;
+	return ret;
+}
+
+// discrete field (main): a sweep is one update of every time slice
+Result discrete (const Parameters &params, const Problem &p, double wall) {
+	SimulationParameters sp;
+	sp.config.Lx = sp.config.Ly = p.L;
+	sp.config.Lz = 1;
+	sp.config.beta = p.beta;
+	sp.config.N = std::max(int(std::ceil(p.beta/params.getNumber("dtau", 0.1))), 1);
+	sp.config.U = p.U;
+	sp.config.mu = sp.config.B = 0.0;
+	sp.config.tx = sp.config.ty = 1.0;
+	sp.config.tz = 0.0;
+	sp.has_seed = true;
+	sp.seed = params.getInteger("SEED", 42);
+	sp.use_fft = true;
+	Simulation sim(sp);
+	Result ret = run(wall, [&] () {
+			for (int t=0;t<sim.timeSlices();t++) sim.update();
+			return sim.current_double_occupancy();
+			});
+	ret.drift = sim.max_drift();
+	return ret;
+}
+
+// continuous time (generic): a sweep visits every slice in both directions,
+// as in generic
+Result lct (Parameters params, const Problem &p, double wall) {
+	const int V = p.L*p.L;
+	Eigen::MatrixXd H = Eigen::MatrixXd::Zero(V, V);
+	for (int x=0;x<V;x++) {
+		const int i = x%p.L, j = x/p.L;
+		H(x, (i+1)%p.L+j*p.L) = H((i+1)%p.L+j*p.L, x) = -1.0;
+		H(x, i+(j+1)%p.L*p.L) = H(i+(j+1)%p.L*p.L, x) = -1.0;
+	}
+	Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> es(H);
+	Eigen::MatrixXd U = Eigen::MatrixXd::Zero(2*V, 2*V);
+	U.topLeftCorner(V, V) = U.bottomRightCorner(V, V) = es.eigenvectors();
+	Eigen::VectorXd e(2*V);
+	e << es.eigenvalues(), es.eigenvalues();
+	params.setString("beta", to_string(p.beta));
+	params.setString("U", to_string(p.U));
+	LCTSimulation::Interaction model;
+	model.setup(params);
+	model.set_lattice_eigenvectors(U);
+	model.set_lattice_eigenvalues(e);
+	LCTSimulation sim(params, model, 0);
+	Result ret = run(wall, [&] () {
+			for (size_t j=0;j<sim.full_sweep_size();j++) {
+				sim.prepare();
+				sim.sweep();
+				sim.next();
+			}
+			return sim.sign()*sim.interaction_energy(sim.green_function())/p.U/sim.volume();
+			});
+	ret.drift = std::fabs(sim.probability()-sim.exact_probability());
+	return ret;
+}
+
+// The standalone engines run as they are built, from bin_dir, and are
+// killed after wall seconds. Their progress lines give the sweep counts:
+// v3ct and pqmc print the current sweep when sent SIGUSR1, which happens
+// after a quarter of wall and at wall; stable and full log the updates of
+// 100 and 10 flips every 5 and 2 seconds, and the rate is taken between the
+// first line after a quarter of wall and the last one (from the start if
+// there is only one). They measure nothing that gives tau or drift.
+struct External {
+	string command;
+	size_t sweeps;
+	double seconds;
+	long peak_kb;
+	string note; // why there is no result
+};
+
+// seconds since t0
+double since (steady_clock::time_point t0) {
+	return duration_cast<seconds_type>(steady_clock::now()-t0).count();
+}
+
+External external (const string &engine, const Parameters &params, const Problem &p, double wall) {
+	External ret = { params.getString("bin_dir", "../..")+"/"+engine, 0, 0.0, 0, "", };
+	const bool v3 = engine=="v3ct" || engine=="pqmc";
+	const int N = std::max(int(std::ceil(p.beta/params.getNumber("dtau", 0.1))), 1);
+	const double flips = engine=="stable"?100.0:10.0; // per update
+	if (access(ret.command.c_str(), X_OK)!=0) {
+		ret.note = "not built: "+ret.command;
+		return ret;
+	}
+	if (v3 && p.L!=4) {
+		ret.note = "fixed 4x4 lattice";
+		return ret;
+	}
+	vector<string> args = { ret.command, };
+	char job[] = "/tmp/engines_XXXXXX";
+	if (v3) {
+		// half filling is mu=U/2 in their parametrization
+		for (double x : { p.beta, p.U/2.0, p.U, params.getNumber("K", 6.0), }) args.push_back(to_string(x));
+		args.push_back("/dev/null");
+	} else {
+		int fd = mkstemp(job);
+		if (fd<0) {
+			ret.note = "cannot write the job file";
+			return ret;
+		}
+		close(fd);
+		ofstream out(job);
+		out << "return { THREADS = 1, { THERMALIZATION = " << std::numeric_limits<int>::max() << ", SWEEPS = 0, SEED = " << params.getInteger("SEED", 42)
+			<< ", Lx = " << p.L << ", Ly = " << p.L << ", Lz = 1, N = " << N << ", T = " << 1.0/p.beta
+			<< ", tx = 1, ty = 1, tz = 0, Vx = 0, Vy = 0, Vz = 0, U = " << p.U
+			<< ", mu = 0, B = 0, h = 0, OUTPUT = '/dev/null', SLICES = 1, SVD = 1, SVDPERIOD = 0, }, }" << endl;
+		args.push_back(job);
+	}
+	int fd[2];
+	if (pipe(fd)!=0) {
+		ret.note = "pipe failed";
+		return ret;
+	}
+	const steady_clock::time_point t0 = steady_clock::now();
+	pid_t pid = fork();
+	if (pid==0) {
+		dup2(fd[1], 2);
+		int null = open("/dev/null", O_WRONLY);
+		dup2(null, 1);
+		close(fd[0]);
+		vector<char*> argv;
+		for (string &a : args) argv.push_back(&a[0]);
+		argv.push_back(nullptr);
+		execv(argv[0], argv.data());
+		_exit(127);
+	}
+	close(fd[1]);
+	vector<pair<double, double>> progress; // time and sweeps so far
+	double offset = 0.0; // thermalization sweeps of pqmc, whose counter restarts afterwards
+	int asked = 0; // SIGUSR1 sent
+	string buffer;
+	bool reading = pid>0;
+	while (reading) {
+		const double t = since(t0);
+		if (v3 && asked==0 && t>=0.25*wall) kill(pid, SIGUSR1), asked++;
+		if (v3 && asked==1 && t>=wall) kill(pid, SIGUSR1), asked++;
+		// v3 answers at the end of the current sweep
+		if ((v3 && progress.size()>=2) || t>=(v3?2.0:1.0)*wall) break;
+		struct pollfd pfd = { fd[0], POLLIN, 0, };
+		if (poll(&pfd, 1, 100)<=0) continue;
+		char buf[4096];
+		ssize_t n = read(fd[0], buf, sizeof(buf));
+		if (n<=0) break;
+		buffer.append(buf, n);
+		size_t end;
+		while ((end = buffer.find('\n'))!=string::npos) {
+			const string line = buffer.substr(0, end);
+			buffer.erase(0, end+1);
+			double b, k;
+			if (sscanf(line.c_str(), "thermalized after %lf", &k)==1) {
+				offset = k;
+			} else if (sscanf(line.c_str(), "beta =%lf %lf sweeps", &b, &k)==2) {
+				progress.push_back(make_pair(since(t0), offset+k));
+			} else if (line.find("thermalizing:")!=string::npos) {
+				stringstream in(line.substr(line.find("thermalizing:")+13));
+				if (in >> k) progress.push_back(make_pair(since(t0), k*flips/N/(p.L*p.L)));
+			}
+		}
+	}
+	if (pid>0) kill(pid, SIGKILL);
+	close(fd[0]);
+	int status = 0;
+	struct rusage usage;
+	if (pid>0 && wait4(pid, &status, 0, &usage)==pid) ret.peak_kb = usage.ru_maxrss;
+	if (!v3) unlink(job);
+	if (pid<0) {
+		ret.note = "fork failed";
+	} else if (WIFEXITED(status) && WEXITSTATUS(status)==127) {
+		ret.note = "cannot run "+ret.command;
+	} else if (WIFEXITED(status)) {
+		ret.note = "exited with status "+to_string(WEXITSTATUS(status));
+	} else if (progress.empty()) {
+		ret.note = "no progress output";
+	} else {
+		size_t first = 0;
+		while (first+1<progress.size() && progress[first].first<0.25*wall) first++;
+		if (first+1==progress.size() && first>0) first--;
+		pair<double, double> a = first+1<progress.size()?progress[first]:make_pair(0.0, 0.0);
+		const pair<double, double> &b = progress.back();
+		ret.sweeps = b.second-a.second;
+		ret.seconds = b.first-a.first;
+	}
+	return ret;
+}
+
+vector<double> list (const Parameters &params, const string &key, const string &def) {
+	vector<double> ret;
+	stringstream in(params.getString(key, def));
+	string x;
+	while (getline(in, x, ',')) ret.push_back(atof(x.c_str()));
+	return ret;
+}
+
+// Sweep throughput of the engines on a grid of square lattices, one tab
+// separated line per engine and problem:
+//
+//   engine L beta U sweeps seconds sweeps_per_s tau samples_per_s drift peak_kb note
+//
+// Every point runs for wall seconds in a child process, so that peak_kb is
+// the peak resident memory of that run alone. samples_per_s divides the
+// throughput by 1+2 tau, with tau the autocorrelation time of the double
+// occupancy from the binning analysis (0 when the run is too short to tell). drift is
+// the largest difference of the log weight between the fast updates and a
+// recomputation. The sweeps of the two engines differ: compare samples_per_s.
+//
+// The standalone engines (v3ct, pqmc, stable, full) keep their classes in
+// their main programs and cannot be linked here: they are run from bin_dir
+// as described at external(), with nan where they cannot tell, and a row
+// with nan and the reason in note where they cannot run at all. A sweep is
+// N*V flips for stable and full, one pass over all slices for v3ct and pqmc.
+//
+// usage: engines [--wall_time 10] [--sides 4,6] [--betas 2,5] [--Us 2,4] [--dtau 0.1] [--K 6] [--bin_dir ../..]
+int main (int argc, char **argv) {
+	Parameters params(argc, argv);
+	const double wall = params.getNumber("wall_time", 10.0);
+	cout << "engine\tL\tbeta\tU\tsweeps\tseconds\tsweeps_per_s\ttau\tsamples_per_s\tdrift\tpeak_kb\tnote" << endl;
+	for (double L : list(params, "sides", "4,6")) for (double beta : list(params, "betas", "2,5")) for (double U : list(params, "Us", "2,4")) {
+		const Problem p = { int(L), beta, U, };
+		for (const string engine : { "main", "generic", }) {
+			int fd[2];
+			if (pipe(fd)!=0) return 1;
+			pid_t pid = fork();
+			if (pid<0) return 1;
+			if (pid==0) {
+				close(fd[0]);
+				Result r = engine=="main"?discrete(params, p, wall):lct(params, p, wall);
+				ostringstream out;
+				out << r.sweeps << '\t' << r.seconds << '\t' << r.sweeps/r.seconds << '\t' << r.tau << '\t' << r.sweeps/r.seconds/(1.0+2.0*r.tau) << '\t' << r.drift;
+				const string s = out.str();
+				_exit(write(fd[1], s.data(), s.size())==ssize_t(s.size())?0:1);
+			}
+			close(fd[1]);
+			string line;
+			char buf[256];
+			ssize_t n;
+			while ((n = read(fd[0], buf, sizeof(buf)))>0) line.append(buf, n);
+			close(fd[0]);
+			int status = 0;
+			struct rusage usage;
+			wait4(pid, &status, 0, &usage);
+			if (!WIFEXITED(status) || WEXITSTATUS(status)!=0) {
+				cerr << engine << " failed at L=" << p.L << " beta=" << p.beta << " U=" << p.U << endl;
+				continue;
+			}
+			cout << engine << '\t' << p.L << '\t' << p.beta << '\t' << p.U << '\t' << line << '\t' << usage.ru_maxrss << "\t-" << endl;
+		}
+		for (const string engine : { "v3ct", "pqmc", "stable", "full", }) {
+			const External r = external(engine, params, p, wall);
+			cout << engine << '\t' << p.L << '\t' << p.beta << '\t' << p.U << '\t';
+			if (r.note.empty()) {
+				cout << r.sweeps << '\t' << r.seconds << '\t' << r.sweeps/r.seconds << "\tnan\tnan\tnan\t" << r.peak_kb << "\t-" << endl;
+			} else {
+				cout << "nan\tnan\tnan\tnan\tnan\tnan\t" << (r.peak_kb>0?to_string(r.peak_kb):"nan") << '\t' << r.note << endl;
+			}
+		}
+	}
+	return 0;
+}
+
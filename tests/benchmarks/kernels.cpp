@@ -0,0 +1,101 @@
+#include "benchmark.hpp"
+
+#include "configuration.hpp"
+#include "hubbard.hpp"
+#include "philox.hpp"
+#include "svd.hpp"
+
+#include <vector>
+#include <iostream>
+#include <Eigen/Dense>
+
+using namespace std;
+using namespace Eigen;
+
+typedef HubbardInteraction<true> Interaction;
+
+// Hubbard ring of V sites in spin blocks, as LCTSimulation uses it
+Interaction ring (const Parameters &params, size_t V) {
+	MatrixXd H = MatrixXd::Zero(V, V);
+	for (size_t x=0;x<V;x++) H(x, (x+1)%V) = H((x+1)%V, x) = -1.0;
+	SelfAdjointEigenSolver<MatrixXd> es(H);
+	MatrixXd U = MatrixXd::Zero(2*V, 2*V);
+	U.topLeftCorner(V, V) = U.bottomRightCorner(V, V) = es.eigenvectors();
+	VectorXd e(2*V);
+	e << es.eigenvalues(), es.eigenvalues();
+	Interaction I;
+	I.setup(params);
+	I.set_lattice_eigenvectors(U);
+	I.set_lattice_eigenvalues(e);
+	return I;
+}
+
+// kernels of the LCT code on rings of 8 to max_sites sites, and at
+// densities of 0.5 to 4 vertices per site in each slice where it matters.
+//
+// usage: kernels [--max_sites 128] [--min_time 0.5] [--beta 4] [--U 4] [--K 6]
+int main (int argc, char **argv) {
+	Parameters params(argc, argv);
+	const size_t max_sites = params.getInteger("max_sites", 128);
+	Benchmark bench(cout, params.getNumber("min_time", 0.5));
+	if (!params.contains("beta")) params.setString("beta", "4");
+	const vector<double> densities = { 0.5, 1.0, 2.0, 4.0, };
+	Philox generator(params.getInteger("SEED", 42));
+	bench.header();
+	for (size_t V=8;V<=max_sites;V*=2) {
+		const size_t N = 2*V;
+		Interaction I = ring(params, V);
+		SVDHelper svd;
+		svd.setIdentity(N);
+		svd.U = MatrixXd::Random(N, N);
+		svd.S = VectorXd::LinSpaced(N, -10.0, 10.0).array().exp();
+		bench("SVDHelper::absorbU", V, 0.0, [&] () { svd.absorbU(); });
+		bench("SVDHelper::add_identity", V, 0.0, [&] () { svd.add_identity(); });
+		svd.S = VectorXd::LinSpaced(N, -10.0, 10.0).array().exp();
+		bench("SVDHelper::get_propagator", V, 0.0, [&] () { svd.get_propagator(1.0); });
+
+		Interaction::Vertex v = I.generate(generator);
+		MatrixXd A = MatrixXd::Random(N, N);
+		Interaction::MatrixType u = Interaction::MatrixType::Random(N, 2);
+		// a vertex and its inverse per call, which leaves the matrix as it was
+		bench("HubbardInteraction::apply_displaced_vertex_on_the_left", V, 0.0, [&] () {
+				I.apply_displaced_vertex_on_the_left(v, A);
+				I.apply_displaced_inverse_on_the_left(v, A);
+				});
+		bench("HubbardInteraction::apply_displaced_vertex_on_the_right", V, 0.0, [&] () {
+				I.apply_displaced_vertex_on_the_right(v, A);
+				I.apply_displaced_inverse_on_the_right(v, A);
+				});
+		bench("HubbardInteraction::apply_displaced_vertex_on_the_left(Nx2)", V, 0.0, [&] () {
+				I.apply_displaced_vertex_on_the_left(v, u);
+				I.apply_displaced_inverse_on_the_left(v, u);
+				});
+
+		for (double density : densities) {
+			Configuration<Interaction> conf(params, I);
+			conf.setup(params);
+			for (size_t i=0;i<conf.slice_number();i++) {
+				conf.set_index(i);
+				for (size_t j=0;j<density*V;j++) conf.insert(conf.generate_vertex(generator));
+			}
+			conf.set_index(0);
+			conf.compute_right_side(0);
+			conf.start();
+			conf.compute_B();
+			conf.compute_propagators_2();
+			Slice<Interaction> &slice = conf.slice(0);
+			// the input is reset on every call so that it does not overflow
+			const MatrixXd A0 = MatrixXd::Random(N, N);
+			bench("Slice::apply_matrix", V, density, [&] () { A = A0; slice.apply_matrix(A); });
+			Interaction::MatrixType vt;
+			size_t k = 0;
+			bench("Slice::matrixUV", V, density, [&] () { slice.matrixUV(slice.get_vertex(k++%slice.size()), u, vt); });
+			bench("Configuration::compute_propagators_2", V, density, [&] () { conf.compute_propagators_2(); });
+			vector<Interaction::Vertex> proposals(64);
+			for (Interaction::Vertex &w : proposals) w = conf.generate_vertex(generator);
+			bench("Configuration::insert_probability", V, density, [&] () { conf.insert_probability(proposals[k++%proposals.size()]); });
+		}
+	}
+	return 0;
+}
+
@@ -0,0 +1,63 @@
+#include "hubbard.hpp"
+#include "local_observables.hpp"
+
+#include <iostream>
+#include <Eigen/Dense>
+
+using namespace std;
+using namespace Eigen;
+
+const int L = 20;
+
+// compares the eigenbasis evaluation of the local observables and of the
+// interaction energy with the explicit real-space matrix U G U^t
+template <bool B>
+bool check (const Parameters &params) {
+	MatrixXd A = MatrixXd::Random(L, L);
+	MatrixXd U = MatrixXd::Zero(2*L, 2*L);
+	if (B) {
+		// laid out in spin blocks, as set up by HubbardInteraction<true>
+		SelfAdjointEigenSolver<MatrixXd> es(A * A.transpose());
+		U.topLeftCorner(L, L) = U.bottomRightCorner(L, L) = es.eigenvectors();
+	} else {
+		MatrixXd H = MatrixXd::Zero(2*L, 2*L);
+		H.topLeftCorner(L, L) = A * A.transpose();
+		H.bottomRightCorner(L, L) = A.transpose() * A;
+		H.topRightCorner(L, L) = H.bottomLeftCorner(L, L) = MatrixXd::Identity(L, L);
+		SelfAdjointEigenSolver<MatrixXd> es(H);
+		U = es.eigenvectors();
+	}
+	HubbardInteraction<B> I;
+	I.setup(params);
+	I.set_lattice_eigenvectors(U);
+	MatrixXd G = MatrixXd::Random(2*L, 2*L);
+	// with spin blocks G is block diagonal too
+	if (B) G.topRightCorner(L, L).setZero(), G.bottomLeftCorner(L, L).setZero();
+	MatrixXd R = U * G * U.transpose();
+	LocalObservables<HubbardInteraction<B>> local;
+	local.set(I, G);
+	double error = 0.0;
+	for (int i=0;i<2*L;i++) for (int j=0;j<2*L;j++) error = max(error, fabs(local.element(i, j)-R(i, j)));
+	double docc = 0.0;
+	for (int x=0;x<L;x++) {
+		error = max(error, fabs(local.density(x)-R(x, x)-R(x+L, x+L)));
+		docc += local.double_occupancy(x);
+		int y = (x+1)%L;
+		double szsz = R(x, x)*R(y, y) + R(x+L, x+L)*R(y+L, y+L) - R(x, x)*R(y+L, y+L) - R(x+L, x+L)*R(y, y);
+		szsz -= R(x, y)*R(y, x) + R(x+L, y+L)*R(y+L, x+L);
+		error = max(error, fabs(local.spin_correlation(x, y)-0.25*szsz));
+	}
+	ArrayXd d = R.diagonal();
+	double E = I.interaction_strength() * (d.head(L)*d.tail(L)).sum();
+	error = max(error, fabs(I.interaction_energy(G)-E)/max(1.0, fabs(E)));
+	error = max(error, fabs(I.interaction_strength()*docc-E)/max(1.0, fabs(E)));
+	cout << (B?"spin blocks":"full") << ": maximum error " << error << endl;
+	return error<1.0e-10;
+}
+
+int main (int argc, char **argv) {
+	Parameters params(argc, argv);
+	bool ok = check<false>(params);
+	ok = check<true>(params) && ok;
+	return ok?0:1;
+}
@@ -0,0 +1,53 @@
+#include "auxiliary_field.hpp"
+
+#include <random>
+#include <iostream>
+#include <Eigen/Dense>
+
+using namespace std;
+using namespace Eigen;
+
+// compares the bit-packed field kernels with explicit diagonal matrices
+int main (int argc, char **argv) {
+	const double A = 0.3;
+	std::mt19937_64 generator;
+	std::bernoulli_distribution coin(0.5);
+	bool ok = true;
+	for (int V : { 1, 16, 63, 64, 65, 130, }) {
+		const int N = 7;
+		AuxiliaryField field;
+		field.resize(N, V);
+		vector<VectorXd> sigma(N, VectorXd(V));
+		int nup = 0;
+		for (int t=0;t<N;t++) {
+			for (int x=0;x<V;x++) {
+				bool up = coin(generator);
+				field.set(t, x, up);
+				sigma[t][x] = up?A:-A;
+				if (up) nup++;
+			}
+		}
+		// flip twice to leave the field unchanged
+		field.flip(N-1, V-1);
+		field.flip(N-1, V-1);
+		if (field.count_up()!=nup) ok = false;
+		for (int t=0;t<N;t++) {
+			VectorXd d;
+			field.expand(t, A, -A, d);
+			if (d!=sigma[t]) ok = false;
+			MatrixXd M = MatrixXd::Random(V, V+3);
+			MatrixXd R = (VectorXd::Constant(V, 1.0)+sigma[t]).asDiagonal()*M;
+			field.scale_rows(t, M, 1.0+A, 1.0-A);
+			if ((M-R).norm()>1.0e-14*R.norm()) ok = false;
+			M = MatrixXd::Random(V+2, V);
+			R = M*(VectorXd::Constant(V, 1.0)-sigma[t]).asDiagonal();
+			field.scale_cols(t, M, 1.0-A, 1.0+A);
+			if ((M-R).norm()>1.0e-14*R.norm()) ok = false;
+		}
+		field.set_slice(0, true);
+		if (field.count_up(0)!=V) ok = false;
+		cout << "V = " << V << (ok?" ok":" FAILED") << endl;
+	}
+	return ok?0:1;
+}
+
@@ -0,0 +1,129 @@
+#include "doubledouble.hpp"
+#include "mpfr.hpp"
+
+#include <random>
+#include <chrono>
+#include <iostream>
+#include <Eigen/Dense>
+
+using namespace std;
+using namespace Eigen;
+
+typedef Matrix<dd_real, Dynamic, Dynamic> MatrixXdd;
+
+template <typename F>
+double seconds (F f) {
+	auto t0 = chrono::steady_clock::now();
+	f();
+	return chrono::duration<double>(chrono::steady_clock::now()-t0).count();
+}
+
+// log|det(I+B)| and its sign, where B is a product of N slices, in MPFR
+pair<double, int> precise_determinant (int prec, const MatrixXd &P, const vector<VectorXd> &d) {
+	PreciseMatrix A(prec);
+	A = MatrixXd::Identity(P.rows(), P.cols());
+	for (const VectorXd &x : d) {
+		A.scale_rows(x);
+		A.applyOnTheLeft(P);
+	}
+	A += MatrixXd::Identity(P.rows(), P.cols());
+	vector<int> perm;
+	int s = A.in_place_LU(perm);
+	double ret = 0.0;
+	for (int i=0;i<int(A.rows());i++) {
+		if (mpfr_sgn(A.coeff(i, i))<0) s = -s;
+		long e;
+		double m = mpfr_get_d_2exp(&e, A.coeff(i, i), A.rnd());
+		ret += std::log(std::fabs(m)) + e*std::log(2.0);
+	}
+	return pair<double, int>(ret, s);
+}
+
+// the same in double-double with Eigen's LU
+pair<double, int> dd_determinant (const MatrixXd &P, const vector<VectorXd> &d) {
+	MatrixXdd A = MatrixXdd::Identity(P.rows(), P.cols());
+	MatrixXdd Pdd = P.cast<dd_real>();
+	for (const VectorXd &x : d) {
+		A = x.cast<dd_real>().asDiagonal()*A;
+		A = Pdd*A;
+	}
+	A += MatrixXdd::Identity(P.rows(), P.cols());
+	PartialPivLU<MatrixXdd> lu(A);
+	const MatrixXdd &LU = lu.matrixLU();
+	int s = lu.permutationP().determinant();
+	double ret = 0.0;
+	for (int i=0;i<LU.rows();i++) {
+		if (LU(i, i)<dd_real(0.0)) s = -s;
+		ret += log_abs(LU(i, i));
+	}
+	return pair<double, int>(ret, s);
+}
+
+// checks double-double arithmetic and the determinant of a slice product
+// against MPFR, and reports the timings of both
+int main (int argc, char **argv) {
+	const int V = argc>1?atoi(argv[1]):16;
+	const int N = argc>2?atoi(argv[2]):40;
+	bool ok = true;
+
+	// arithmetic against a 256 bit reference
+	std::mt19937_64 generator;
+	std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+	double worst = 0.0;
+	for (int k=0;k<1000;k++) {
+		dd_real a(uniform(generator), uniform(generator)*1.0e-17), b(uniform(generator), uniform(generator)*1.0e-17);
+		dd_real r[] = { a+b, a-b, a*b, a/b, sqrt(abs(a)), };
+		mpfr_t x, y, z, w;
+		mpfr_inits2(256, x, y, z, w, (mpfr_ptr) 0);
+		mpfr_set_d(x, a.hi, MPFR_RNDN); mpfr_add_d(x, x, a.lo, MPFR_RNDN);
+		mpfr_set_d(y, b.hi, MPFR_RNDN); mpfr_add_d(y, y, b.lo, MPFR_RNDN);
+		for (int i=0;i<5;i++) {
+			switch (i) {
+				case 0: mpfr_add(z, x, y, MPFR_RNDN); break;
+				case 1: mpfr_sub(z, x, y, MPFR_RNDN); break;
+				case 2: mpfr_mul(z, x, y, MPFR_RNDN); break;
+				case 3: mpfr_div(z, x, y, MPFR_RNDN); break;
+				case 4: mpfr_abs(z, x, MPFR_RNDN); mpfr_sqrt(z, z, MPFR_RNDN); break;
+			}
+			mpfr_sub_d(w, z, r[i].hi, MPFR_RNDN);
+			mpfr_sub_d(w, w, r[i].lo, MPFR_RNDN);
+			mpfr_div(w, w, z, MPFR_RNDN);
+			worst = max(worst, fabs(mpfr_get_d(w, MPFR_RNDN)));
+		}
+		mpfr_clears(x, y, z, w, (mpfr_ptr) 0);
+	}
+	cout << "arithmetic: maximum relative error " << worst << endl;
+	if (worst>1.0e-29) ok = false;
+
+	// determinant of I + product of slices, as in Simulation::recheck
+	MatrixXd H = MatrixXd::Zero(V, V);
+	for (int i=0;i<V;i++) H(i, (i+1)%V) = H((i+1)%V, i) = -1.0;
+	SelfAdjointEigenSolver<MatrixXd> solver(H);
+	const double dt = 0.1, A = 0.5;
+	MatrixXd P = solver.eigenvectors() * (-dt*solver.eigenvalues().array()).exp().matrix().asDiagonal() * solver.eigenvectors().transpose();
+	std::bernoulli_distribution coin(0.5);
+	vector<VectorXd> d(N, VectorXd(V));
+	for (VectorXd &x : d) for (int i=0;i<V;i++) x[i] = 1.0+(coin(generator)?A:-A);
+
+	pair<double, int> exact, low, dd;
+	double t_exact = seconds([&] () { exact = precise_determinant(512, P, d); });
+	double t_low = seconds([&] () { low = precise_determinant(128, P, d); });
+	double t_dd = seconds([&] () { dd = dd_determinant(P, d); });
+	cout << "MPFR 512 bits: " << exact.first << " sign " << exact.second << " in " << t_exact << "s" << endl;
+	cout << "MPFR 128 bits: " << low.first << " sign " << low.second << " in " << t_low << "s" << endl;
+	cout << "double-double: " << dd.first << " sign " << dd.second << " in " << t_dd << "s" << endl;
+	if (dd.second!=exact.second || fabs(dd.first-exact.first)>1.0e-10*max(1.0, fabs(exact.first))) ok = false;
+
+	// eigenvalues through Eigen's generic solver
+	MatrixXd R = MatrixXd::Random(V, V);
+	EigenSolver<MatrixXd> es(R, false);
+	EigenSolver<MatrixXdd> es_dd(R.cast<dd_real>(), false);
+	VectorXd ev = es.eigenvalues().real(), ev_dd(V);
+	for (int i=0;i<V;i++) ev_dd[i] = double(es_dd.eigenvalues()[i].real());
+	std::sort(ev.data(), ev.data()+V);
+	std::sort(ev_dd.data(), ev_dd.data()+V);
+	cout << "eigenvalues: difference from double " << (ev-ev_dd).norm() << endl;
+	if ((ev-ev_dd).norm()>1.0e-8*ev.norm()) ok = false;
+	return ok?0:1;
+}
+
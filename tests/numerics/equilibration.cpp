@@ -0,0 +1,35 @@
+#include "equilibration.hpp"
+
+#include <random>
+#include <iostream>
+
+using namespace std;
+
+// feeds AR(1) noise (autocorrelation time ~ tau, amplitude 0.1) around a
+// mean that relaxes from 1 to 0 over the time scale relax, and reports when
+// the detector declares stationarity: the bias left must be below the noise
+int main (int argc, char **argv) {
+	std::mt19937_64 generator;
+	std::normal_distribution<double> normal;
+	bool ok = true;
+	for (double tau : { 1.0, 10.0, }) {
+		for (double relax : { 10.0, 100.0, 300.0, }) {
+			EquilibrationDetector detector(100);
+			int a = detector.add_observable("relaxing");
+			int b = detector.add_observable("constant");
+			const double rho = std::exp(-1.0/tau);
+			double x = 0.0;
+			size_t n = 0;
+			for (n=1;n<=1000000;n++) {
+				x = rho*x + std::sqrt(1.0-rho*rho)*0.1*normal(generator);
+				detector.add(a, std::exp(-double(n)/relax) + x);
+				detector.add(b, 1.0);
+				if (detector.check()) break;
+			}
+			double bias = std::exp(-0.5*double(n)/relax); // at the start of the last half
+			cout << "tau = " << tau << ", relaxation = " << relax << ": " << detector.status() << ", bias " << bias << endl;
+			if (bias>0.1) ok = false;
+		}
+	}
+	return ok?0:1;
+}
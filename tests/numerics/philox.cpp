@@ -0,0 +1,65 @@
+#include "philox.hpp"
+
+#include <random>
+#include <sstream>
+#include <vector>
+#include <iostream>
+#include <cmath>
+
+using namespace std;
+
+// checks the known answers of Philox4x32-10, that bulk generation, discard
+// and serialization reproduce the plain stream, and the mean of a few streams
+int main (int argc, char **argv) {
+	bool ok = true;
+
+	// known answers from the reference implementation (Random123)
+	Philox zero(0, 0);
+	ok = ok && zero()==0xe169c58d6627e8d5ull && zero()==0x9b00dbd8bc57ac4cull;
+	Philox pi(0x299f31d0a4093822ull, 0x0370734413198a2eull);
+	pi.discard(0x85a308d3243f6a88ull); // twice the block number in outputs
+	pi.discard(0x85a308d3243f6a88ull);
+	ok = ok && pi()==0x94fdccebd16cfe09ull && pi()==0x24126ea15001e420ull;
+	cout << "known answers" << (ok?" ok":" FAILED") << endl;
+
+	Philox a(42, 3), b(42, 3), c(42, 3);
+	vector<uint64_t> reference(1001);
+	for (uint64_t &x : reference) x = a();
+	// bulk generation from an odd position
+	vector<uint64_t> bulk(1000);
+	b();
+	b.generate(bulk.data(), bulk.size());
+	for (size_t i=0;i<bulk.size();i++) if (bulk[i]!=reference[i+1]) ok = false;
+	// discard and restore from text
+	c.discard(501);
+	stringstream buf;
+	buf << c;
+	Philox d;
+	buf >> d;
+	if (d!=c || d()!=reference[501] || c()!=reference[501]) ok = false;
+	stringstream bad("1 2 3 4");
+	bad >> d;
+	if (!bad.fail() || d!=c) ok = false;
+	cout << "bulk, discard and serialization" << (ok?" ok":" FAILED") << endl;
+
+	// streams split from one seed are distinct and uniform
+	const int n = 100000;
+	Philox g(7);
+	for (uint64_t s=0;s<4;s++) {
+		Philox h = g.split(s);
+		vector<double> u(n);
+		h.generate_uniform(u.data(), n);
+		double sum = 0.0;
+		for (double x : u) sum += x;
+		double mean = sum/n;
+		// five standard deviations of the mean of n uniforms
+		if (std::fabs(mean-0.5)>5.0*std::sqrt(1.0/12.0/n)) ok = false;
+		if (s>0 && g.split(0)()==h()) ok = false;
+		cout << "stream " << s << " mean " << mean << endl;
+	}
+	std::uniform_real_distribution<double> uniform;
+	double x = uniform(g);
+	if (!(x>=0.0 && x<1.0)) ok = false;
+	return ok?0:1;
+}
+
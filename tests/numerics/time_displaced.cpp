@@ -0,0 +1,114 @@
+#include "time_displaced.hpp"
+
+#include <random>
+#include <iostream>
+#include <Eigen/Dense>
+
+#include <algorithm>
+
+using namespace std;
+using namespace Eigen;
+
+// compares TimeDisplacedEngine against the serial per-spin chains
+int main (int argc, char **argv) {
+	const int V = 16;
+	const int N = 40;
+	const double dt = 0.1, B = 0.3, mu = 0.2, A = 0.4, X = 1.0-A*A;
+	std::mt19937_64 generator;
+	std::bernoulli_distribution coin(0.5);
+	// propagators exp(-dt H) and exp(dt H) of a random symmetric hopping matrix
+	MatrixXd H = MatrixXd::Random(V, V);
+	H = (H+H.transpose()).eval();
+	SelfAdjointEigenSolver<MatrixXd> solver(H);
+	MatrixXd P = solver.eigenvectors() * (-dt*solver.eigenvalues().array()).exp().matrix().asDiagonal() * solver.eigenvectors().transpose();
+	MatrixXd P_inv = solver.eigenvectors() * (+dt*solver.eigenvalues().array()).exp().matrix().asDiagonal() * solver.eigenvectors().transpose();
+	vector<VectorXd> sigma(N, VectorXd(V));
+	for (VectorXd &s : sigma) for (int i=0;i<V;i++) s[i] = coin(generator)?A:-A;
+
+	// exact results in extended precision, without stabilization
+	typedef Matrix<long double, Dynamic, Dynamic> MatrixXld;
+	vector<MatrixXd> exact_up(N+1), exact_dn(N+1);
+	for (int t=0;t<=N;t++) {
+		for (int spin=0;spin<2;spin++) {
+			double b = spin==0?B:-B;
+			int n_f = spin==0?t:N-t;
+			int n_b = spin==0?N-t:t;
+			MatrixXld F = MatrixXld::Identity(V, V), G = MatrixXld::Identity(V, V);
+			for (int s=0;s<n_f;s++) {
+				F = P.cast<long double>()*F;
+				F = (1.0L+sigma[s].cast<long double>().array()).matrix().asDiagonal()*F;
+			}
+			for (int s=0;s<n_b;s++) {
+				G = (1.0L-sigma[s].cast<long double>().array()).matrix().asDiagonal()*G;
+				G = P_inv.cast<long double>()*G;
+			}
+			F *= std::exp((long double)(+dt*b*0.5+dt*mu)*n_f);
+			G *= std::exp((long double)(-dt*b*0.5-dt*mu-std::log(X))*n_b);
+			(spin==0?exact_up:exact_dn)[t] = MatrixXld(F+G).inverse().cast<double>();
+		}
+	}
+
+	// serial chains as in the original implementation
+	SVDHelper help;
+	vector<SVDHelper> flist(N+1), blist(N+1);
+	vector<MatrixXd> G_up(N+1), G_dn(N+1);
+	for (int spin=0;spin<2;spin++) {
+		double b = spin==0?B:-B;
+		help.setIdentity(V);
+		for (int t=0;t<=N;t++) {
+			flist[t] = help;
+			help.U.applyOnTheLeft(P);
+			help.S *= std::exp(+dt*b*0.5+dt*mu);
+			help.U.applyOnTheLeft((VectorXd::Constant(V, 1.0)+sigma[t%N]).asDiagonal());
+			help.absorbU();
+		}
+		help.setIdentity(V);
+		for (int t=0;t<=N;t++) {
+			blist[t] = help;
+			help.U.applyOnTheLeft((VectorXd::Constant(V, 1.0)-sigma[t%N]).asDiagonal());
+			help.S *= std::exp(-dt*b*0.5-dt*mu)/X;
+			help.U.applyOnTheLeft(P_inv);
+			help.absorbU();
+		}
+		for (int t=0;t<=N;t++) {
+			if (spin==0) {
+				help = blist[N-t];
+				help.add_svd(flist[t]);
+				G_up[t] = help.inverse();
+			} else {
+				help = flist[N-t];
+				help.add_svd(blist[t]);
+				G_dn[t] = help.inverse();
+			}
+		}
+	}
+	double reference = 0.0;
+	for (int t=0;t<=N;t++) {
+		reference = max(reference, (G_up[t]-exact_up[t]).norm()/exact_up[t].norm());
+		reference = max(reference, (G_dn[t]-exact_dn[t]).norm()/exact_dn[t].norm());
+	}
+	cout << "serial chains: maximum relative error " << reference << endl;
+
+	bool ok = true;
+	for (int threads : { 1, 4 }) {
+		TimeDisplacedEngine engine(threads);
+		engine.build(N, V, [&] (int t, MatrixXd &U) {
+			U.applyOnTheLeft(P);
+			U.array().colwise() *= 1.0+sigma[t%N].array();
+		}, [&] (int t, MatrixXd &U) {
+			U.array().colwise() *= 1.0-sigma[t%N].array();
+			U.applyOnTheLeft(P_inv);
+		});
+		vector<double> err_up(N+1), err_dn(N+1);
+		engine.evaluate(false, -dt*B*0.5-dt*mu-std::log(X), +dt*B*0.5+dt*mu, [&] (int t, const MatrixXd &G) {
+			err_up[t] = (G-exact_up[t]).norm()/exact_up[t].norm();
+		});
+		engine.evaluate(true, -dt*B*0.5+dt*mu, +dt*B*0.5-dt*mu-std::log(X), [&] (int t, const MatrixXd &G) {
+			err_dn[t] = (G-exact_dn[t]).norm()/exact_dn[t].norm();
+		});
+		double e = max(*max_element(err_up.begin(), err_up.end()), *max_element(err_dn.begin(), err_dn.end()));
+		cout << threads << " threads: maximum relative error " << e << endl;
+		if (e>10.0*reference+1.0e-12) ok = false;
+	}
+	return ok?0:1;
+}
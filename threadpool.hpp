@@ -0,0 +1,92 @@
+#ifndef THREADPOOL_HPP
+#define THREADPOOL_HPP
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+// Persistent pool of worker threads for data-parallel loops.
+// parallel_for(n, f) calls f(i, worker) for every i in [0, n), where worker
+// identifies the executing thread (0 is the calling thread). Indices are
+// handed out dynamically, so uneven iterations balance themselves.
+// A pool of size 1 spawns no threads and runs everything inline.
+class ThreadPool {
+	private:
+		std::vector<std::thread> threads_;
+		std::mutex mutex_;
+		std::condition_variable start_;
+		std::condition_variable done_;
+		const std::function<void (int, int)> *job_;
+		std::atomic<int> next_;
+		int n_;
+		int running_;
+		unsigned long generation_;
+		bool quit_;
+
+		void work (int worker) {
+			int i;
+			while ((i = next_.fetch_add(1))<n_) (*job_)(i, worker);
+		}
+
+		void run (int worker) {
+			unsigned long seen = 0;
+			while (true) {
+				{
+					std::unique_lock<std::mutex> lock(mutex_);
+					start_.wait(lock, [&] { return quit_ || generation_!=seen; });
+					if (quit_) return;
+					seen = generation_;
+				}
+				work(worker);
+				{
+					std::unique_lock<std::mutex> lock(mutex_);
+					if (--running_==0) done_.notify_one();
+				}
+			}
+		}
+
+	public:
+		ThreadPool (int n = 1) : job_(nullptr), next_(0), n_(0), running_(0), generation_(0), quit_(false) {
+			for (int i=1;i<n;i++) threads_.push_back(std::thread(&ThreadPool::run, this, i));
+		}
+
+		ThreadPool (const ThreadPool&) = delete;
+		ThreadPool& operator= (const ThreadPool&) = delete;
+
+		~ThreadPool () {
+			{
+				std::unique_lock<std::mutex> lock(mutex_);
+				quit_ = true;
+			}
+			start_.notify_all();
+			for (std::thread &t : threads_) t.join();
+		}
+
+		int size () const { return threads_.size()+1; }
+
+		void parallel_for (int n, const std::function<void (int, int)> &f) {
+			if (threads_.empty() || n<2) {
+				for (int i=0;i<n;i++) f(i, 0);
+				return;
+			}
+			{
+				std::unique_lock<std::mutex> lock(mutex_);
+				job_ = &f;
+				n_ = n;
+				next_ = 0;
+				running_ = threads_.size();
+				generation_++;
+			}
+			start_.notify_all();
+			work(0);
+			std::unique_lock<std::mutex> lock(mutex_);
+			done_.wait(lock, [&] { return running_==0; });
+			job_ = nullptr;
+		}
+};
+
+#endif // THREADPOOL_HPP
+
@@ -0,0 +1,83 @@
+#ifndef TIME_DISPLACED_HPP
+#define TIME_DISPLACED_HPP
+
+#include "svd.hpp"
+#include "types.hpp"
+#include "threadpool.hpp"
+
+#include <vector>
+#include <cmath>
+
+// Computes the time-displaced Green's functions
+//   G(t) = ( a^(N-t) F(N-t) + b^t S(t) )^-1,  t = 0..N
+// where F and S are two chains of stabilized products (forward and
+// backward propagators) kept in SVD form. The chains are built once per
+// measurement and can be shared by both spin species, which only differ
+// by the scalar factors a and b. The N+1 evaluations are independent and
+// are spread over a thread pool. All storage is kept between calls.
+class TimeDisplacedEngine {
+	private:
+		int N_;
+		int V_;
+		std::vector<SVDHelper> forward_;
+		std::vector<SVDHelper> backward_;
+		std::vector<SVDHelper> helpers_; // one per worker
+		std::vector<Matrix_d> results_; // one per worker
+		ThreadPool pool_;
+
+	public:
+		TimeDisplacedEngine (int threads = 1) : N_(0), V_(0), pool_(threads) {
+			helpers_.resize(pool_.size());
+			results_.resize(pool_.size());
+		}
+
+		int threads () const { return pool_.size(); }
+
+		// forward(t) = B(t-1)...B(0), backward(t) = the same for the inverse propagators
+		std::vector<SVDHelper> &forward () { return forward_; }
+		std::vector<SVDHelper> &backward () { return backward_; }
+
+		// builds both chains concurrently; step_f(t, U) and step_b(t, U) multiply U on
+		// the left by the t-th forward and backward slice, respectively
+		template <typename StepF, typename StepB>
+		void build (int N, int V, StepF step_f, StepB step_b) {
+			N_ = N;
+			V_ = V;
+			forward_.resize(N+1);
+			backward_.resize(N+1);
+			pool_.parallel_for(2, [&] (int which, int worker) {
+				std::vector<SVDHelper> &chain = which==0?forward_:backward_;
+				SVDHelper &help = helpers_[worker];
+				help.setIdentity(V);
+				for (int t=0;t<=N;t++) {
+					chain[t] = help;
+					if (t==N) break;
+					if (which==0) step_f(t, help.U);
+					else step_b(t, help.U);
+					help.absorbU();
+				}
+			});
+		}
+
+		// calls f(t, G(t)) for every t from the pool threads; forward_first selects
+		// which chain plays the role of F, log_a and log_b are the logarithms of
+		// the per-slice scalar factors a and b
+		template <typename F>
+		void evaluate (bool forward_first, double log_a, double log_b, F f) {
+			const std::vector<SVDHelper> &first = forward_first?forward_:backward_;
+			const std::vector<SVDHelper> &second = forward_first?backward_:forward_;
+			const int N = N_;
+			pool_.parallel_for(N+1, [&] (int t, int worker) {
+				SVDHelper &help = helpers_[worker];
+				Matrix_d &G = results_[worker];
+				help = first[N-t];
+				help.S *= std::exp(log_a*(N-t));
+				help.add_svd(second[t], std::exp(log_b*t));
+				help.inverse(G);
+				f(t, G);
+			});
+		}
+};
+
+#endif // TIME_DISPLACED_HPP
+
@@ -0,0 +1,202 @@
+#ifndef TIMERS_HPP
+#define TIMERS_HPP
+
+#include "logger.hpp"
+
+#include <cstdint>
+
+// Time spent in the hot phases of the simulations, enabled with
+// -DLCT_TIMERS (make timers); otherwise PHASE_TIMER expands to nothing and
+// the reports do nothing.
+//
+// PHASE_TIMER(p) times the rest of the enclosing scope as phase p. Times are
+// exclusive: a scope nested in another one is subtracted from the outer
+// phase, so the phases add up to the timed part of the run. Every thread
+// accumulates into its own table, which report() sums with the tables of
+// the threads that are still running and the totals of those that ended.
+namespace timers {
+	enum phase {
+		slice_application,
+		stabilization,
+		propagators,
+		proposal,
+		accepted_update,
+		measurements,
+		snapshot, // copy of the state to be measured, e.g. for a worker thread
+		fft,
+		checkpoint_io,
+		phase_number
+	};
+
+	inline const char *name (phase p) {
+		static const char *names[phase_number] = {
+			"slice application",
+			"stabilization",
+			"propagators",
+			"proposals",
+			"accepted updates",
+			"measurements",
+			"measurement snapshots",
+			"FFT",
+			"checkpoint I/O",
+		};
+		return names[p];
+	}
+}
+
+#ifdef LCT_TIMERS
+
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+
+namespace timers {
+	typedef std::chrono::steady_clock clock;
+
+	// written by its own thread only: relaxed loads and stores are enough
+	// for report() to read it while it runs, and cost as much as plain ones
+	struct Table {
+		std::atomic<uint64_t> ns[phase_number];
+		std::atomic<uint64_t> calls[phase_number];
+
+		Table () {
+			for (int p=0;p<phase_number;p++) {
+				ns[p].store(0, std::memory_order_relaxed);
+				calls[p].store(0, std::memory_order_relaxed);
+			}
+		}
+
+		void add (phase p, uint64_t t) {
+			ns[p].store(ns[p].load(std::memory_order_relaxed)+t, std::memory_order_relaxed);
+			calls[p].store(calls[p].load(std::memory_order_relaxed)+1, std::memory_order_relaxed);
+		}
+	};
+
+	struct Registry {
+		std::mutex mutex;
+		std::vector<const Table*> tables; // running threads
+		uint64_t ns[phase_number]; // threads that ended
+		uint64_t calls[phase_number];
+		clock::time_point start;
+		std::atomic<int64_t> last_report; // ns since start
+
+		Registry () : start(clock::now()), last_report(0) {
+			std::fill(ns, ns+phase_number, 0);
+			std::fill(calls, calls+phase_number, 0);
+		}
+
+		static Registry &instance () {
+			static Registry r;
+			return r;
+		}
+	};
+
+	struct ThreadTable : public Table {
+		ThreadTable () {
+			Registry &r = Registry::instance();
+			std::lock_guard<std::mutex> lock(r.mutex);
+			r.tables.push_back(this);
+		}
+
+		~ThreadTable () {
+			Registry &r = Registry::instance();
+			std::lock_guard<std::mutex> lock(r.mutex);
+			for (int p=0;p<phase_number;p++) {
+				r.ns[p] += ns[p].load(std::memory_order_relaxed);
+				r.calls[p] += calls[p].load(std::memory_order_relaxed);
+			}
+			r.tables.erase(std::find(r.tables.begin(), r.tables.end(), this));
+		}
+	};
+
+	inline Table &local () {
+		thread_local ThreadTable t;
+		return t;
+	}
+
+	class Scope {
+		phase p_;
+		uint64_t children_; // time spent in nested scopes
+		Scope *parent_;
+		clock::time_point t0_;
+
+		static Scope *&current () {
+			thread_local Scope *s = nullptr;
+			return s;
+		}
+
+		public:
+		explicit Scope (phase p) : p_(p), children_(0), parent_(current()) {
+			local();
+			current() = this;
+			t0_ = clock::now();
+		}
+
+		~Scope () {
+			const uint64_t t = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now()-t0_).count();
+			local().add(p_, t>children_?t-children_:0);
+			if (parent_) parent_->children_ += t;
+			current() = parent_;
+		}
+
+		Scope (const Scope &) = delete;
+		Scope &operator= (const Scope &) = delete;
+	};
+
+	// one line per phase that was entered: total time, share of the timed
+	// time, calls and time per call, summed over all threads
+	inline void report (Logger &log) {
+		Registry &r = Registry::instance();
+		uint64_t ns[phase_number], calls[phase_number];
+		{
+			std::lock_guard<std::mutex> lock(r.mutex);
+			std::copy(r.ns, r.ns+phase_number, ns);
+			std::copy(r.calls, r.calls+phase_number, calls);
+			for (const Table *t : r.tables) {
+				for (int p=0;p<phase_number;p++) {
+					ns[p] += t->ns[p].load(std::memory_order_relaxed);
+					calls[p] += t->calls[p].load(std::memory_order_relaxed);
+				}
+			}
+		}
+		uint64_t total = 0;
+		for (int p=0;p<phase_number;p++) total += ns[p];
+		const double wall = std::chrono::duration<double>(clock::now()-r.start).count();
+		log << "timers:" << 1.0e-9*total << "seconds timed in" << wall << "seconds";
+		for (int p=0;p<phase_number;p++) {
+			if (calls[p]==0) continue;
+			log << "timers:" << name(phase(p)) << 1.0e-9*ns[p] << "seconds," << (100.0*ns[p]/std::max(total, uint64_t(1))) << "percent,"
+				<< calls[p] << "calls," << (1.0e-3*ns[p]/calls[p]) << "us per call";
+		}
+	}
+
+	// report() if interval seconds have passed since the last one; any
+	// thread may call it, only one of them reports
+	inline void report_every (Logger &log, double interval) {
+		Registry &r = Registry::instance();
+		const int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now()-r.start).count();
+		int64_t last = r.last_report.load();
+		if (now-last<interval*1.0e9) return;
+		if (r.last_report.compare_exchange_strong(last, now)) report(log);
+	}
+}
+
+#define PHASE_TIMER_CONCAT(a, b) a##b
+#define PHASE_TIMER_NAME(line) PHASE_TIMER_CONCAT(phase_timer_, line)
+#define PHASE_TIMER(p) timers::Scope PHASE_TIMER_NAME(__LINE__)(timers::p)
+
+#else
+
+namespace timers {
+	inline void report (Logger &) {}
+	inline void report_every (Logger &, double) {}
+}
+
+#define PHASE_TIMER(p)
+
+#endif // LCT_TIMERS
+
+#endif // TIMERS_HPP
+
@@ -12,6 +12,8 @@
 #include "measurements.hpp"
 #include "logger.hpp"
 #include "svd.hpp"
+#include "timers.hpp"
+#include "philox.hpp"
 
 #include <Eigen/Dense>
 #include <Eigen/Eigenvalues>
@@ -61,7 +63,7 @@ std::ostream & operator<< (std::ostream &out, const Vertex& v) {
 }
 
 class VertexFactory {
-	std::mt19937_64 &generator;
+	Philox &generator;
 
 	// RNG distributions
 	std::bernoulli_distribution coin_flip;
@@ -77,7 +79,7 @@ class VertexFactory {
 		randomPosition = std::uniform_int_distribution<size_t>(0, v-1);
 	}
 
-	VertexFactory (std::mt19937_64& g): generator(g) {
+	VertexFactory (Philox &g): generator(g) {
 		coin_flip = std::bernoulli_distribution(0.5);
 		randomPosition = std::uniform_int_distribution<size_t>(0, 0);
 		randomTime = std::uniform_real_distribution<double>(0.0, 1.0);
@@ -547,6 +549,7 @@ class V3Probability {
 		}
 
 		void collectSlices (const V3Configuration &conf, size_t index) {
+			PHASE_TIMER(slice_application);
 			size_t V = conf.volume();
 			size_t n = conf.sliceNumber();
 			size_t m = index;
@@ -565,6 +568,7 @@ class V3Probability {
 		void shiftRight (const V3Configuration &conf, size_t index) {}
 
 		void makeGreenFunction (const V3Configuration &conf) {
+			PHASE_TIMER(propagators);
 			double beta = conf.inverseTemperature();
 			//double mu = conf.chemicalPotential();
 			//double B = conf.magneticField();
@@ -587,6 +591,7 @@ class V3Probability {
 		}
 
 		void prepareUpdateMatrices (V3Configuration &conf, size_t index) {
+			PHASE_TIMER(propagators);
 			conf.reset_slice(index);
 			update_matrix_up = G_up.matrix(); // * conf.slice_up(index).inverse();
 			update_matrix_up.applyOnTheRight(conf.slice_up(index).inverse());
@@ -621,6 +626,7 @@ class V3Probability {
 		}
 
 		void accumulate (Accumulator &acc, const V3Configuration &conf, double t0, double s, int nt = -1) {
+			PHASE_TIMER(slice_application);
 			if (nt<0) nt = 1.5*conf.volume();
 			//acc.start(R);
 			//R = conf.eigenVectors().transpose() * Rd.exp().matrix().asDiagonal() * conf.eigenVectors();
@@ -779,7 +785,7 @@ class V3Probability {
 
 class V3Updater {
 	private:
-	std::mt19937_64 generator;
+	Philox generator;
 	std::bernoulli_distribution coin_flip;
 	std::uniform_int_distribution<size_t> randomPosition;
 	std::uniform_int_distribution<size_t> randomSlice;
@@ -902,6 +908,7 @@ class V3Updater {
 	}
 
 	bool tryInsert (V3Configuration &conf, V3Probability &prob) {
+		PHASE_TIMER(proposal);
 		if (int(updates)>=V_dn.cols()) {
 			flush_updates(conf, prob);
 		}
@@ -942,6 +949,7 @@ class V3Updater {
 	}
 
 	void flush_updates (V3Configuration &conf, V3Probability &prob) {
+		PHASE_TIMER(accepted_update);
 		//debug << "flushing";
 		//debug << p.first << p.second;
 		//debug << update_p.first << update_p.second;
@@ -979,6 +987,7 @@ class V3Updater {
 	double sign () const { return p.second*update_p.second; }
 
 	bool tryRemove (V3Configuration &conf, V3Probability &prob) {
+		PHASE_TIMER(proposal);
 		if (int(updates)>=V_dn.cols()) {
 			flush_updates(conf, prob);
 		}
@@ -1058,6 +1067,7 @@ class V3Measurements {
 		Eigen::MatrixXd rho_up, rho_dn;
 	public:
 		void measure (V3Configuration &conf, V3Probability &prob, V3Updater &updater) {
+			PHASE_TIMER(measurements);
 			updater.flush_updates(conf, prob);
 			size_t V = conf.volume();
 			double beta = conf.inverseTemperature();
@@ -1144,12 +1154,16 @@ int main (int argc, char **argv) {
 	signal(10, my_signal_handler);
 	signal(12, my_signal_handler);
 	signal(14, my_signal_handler);
+	// $SEED replays a run, otherwise the seed comes from /dev/urandom
 	unsigned int seed;
-	std::ifstream seedfile("/dev/urandom");
-	debug << "reading random seed";
-	seedfile.read(reinterpret_cast<char*>(&seed), sizeof(unsigned int));
-	debug << "read random seed";
-	seedfile.close();
+	if (getenv("SEED")) {
+		seed = strtoul(getenv("SEED"), NULL, 10);
+	} else {
+		std::ifstream seedfile("/dev/urandom");
+		seedfile.read(reinterpret_cast<char*>(&seed), sizeof(unsigned int));
+		seedfile.close();
+	}
+	debug << "random seed" << seed;
 
 	double beta = 5.0, mu = 0.5, U = 4.0, K = 5.0;
 	string outfile = "data.out";
@@ -1228,6 +1242,7 @@ int main (int argc, char **argv) {
 	for (int n=0;n<thermalization+sweeps;n++) {
 		double a = updater.sweep(configuration, prob);
 		if (n>=thermalization) measurements.measure(configuration, prob, updater);
+		timers::report_every(debug, 60.0);
 		//measurements.measure_ts(configuration, prob, updater);
 		if (signalled==10) {
 			signalled = 0;
@@ -1256,6 +1271,7 @@ int main (int argc, char **argv) {
 	for (size_t k=0;k<configuration.sliceNumber();k++) {
 		debug << configuration.sliceSize(k);
 	}
+	timers::report(debug);
 
 	std::ofstream out(outfile);
 
@@ -0,0 +1,90 @@
+#ifndef WRITER_HPP
+#define WRITER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <thread>
+
+extern "C" {
+#include <lua.h>
+#include <lualib.h>
+#include <lauxlib.h>
+}
+
+// Owns a lua_State on a dedicated thread. Any thread can push tasks, which
+// are executed by the writer thread in the order they were submitted.
+// Submission is a lock-free push on a singly-linked stack, so producers
+// never wait on each other or on the writer.
+class LuaWriter {
+	public:
+		typedef std::function<void (lua_State *)> task_type;
+
+	private:
+		struct node {
+			task_type task;
+			node *next;
+		};
+
+		lua_State *L;
+		std::atomic<node*> head_;
+		std::atomic<bool> done_;
+		std::atomic<int> pending_;
+		std::thread thread_;
+
+		void run () {
+			while (true) {
+				// read the flag first: everything pushed before finish() is then drained
+				bool done = done_.load();
+				node *list = head_.exchange(nullptr);
+				if (list==nullptr) {
+					if (done) break;
+					std::this_thread::sleep_for(std::chrono::milliseconds(10));
+					continue;
+				}
+				node *queue = nullptr;
+				while (list!=nullptr) {
+					node *n = list->next;
+					list->next = queue;
+					queue = list;
+					list = n;
+				}
+				while (queue!=nullptr) {
+					try {
+						queue->task(L);
+					} catch (...) {
+						std::cerr << "writer: task failed" << std::endl;
+					}
+					node *n = queue->next;
+					delete queue;
+					queue = n;
+					pending_--;
+				}
+			}
+		}
+
+	public:
+		LuaWriter (lua_State *l) : L(l), head_(nullptr), done_(false), pending_(0) {}
+
+		void start () { thread_ = std::thread(&LuaWriter::run, this); }
+
+		void push (task_type t) {
+			node *n = new node{ std::move(t), head_.load() };
+			pending_++;
+			while (!head_.compare_exchange_weak(n->next, n)) {}
+		}
+
+		// number of tasks submitted but not yet completed
+		int pending () const { return pending_.load(); }
+
+		void finish () {
+			done_ = true;
+			if (thread_.joinable()) thread_.join();
+		}
+
+		~LuaWriter () { finish(); }
+};
+
+#endif // WRITER_HPP
+